@@ -77,6 +77,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <sched.h>
+#include <sys/utsname.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <ucontext.h>
 
 #ifndef FUZZY_SYNC_H__
 #define FUZZY_SYNC_H__
@@ -103,6 +113,14 @@ static inline void fzsync_yield()
 })
 #endif /* MAX */
 
+#ifndef MIN
+# define MIN(a, b) ({ \
+	typeof(a) _a = (a); \
+	typeof(b) _b = (b); \
+	_a < _b ? _a : _b; \
+})
+#endif /* MIN */
+
 #ifndef fzsync_printf
 #define fzsync_printf(fmt, ...) do {					\
 	printf("%s:%d: ", __FILE__ + SOURCE_PATH_SIZE, __LINE__);	\
@@ -110,6 +128,65 @@ static inline void fzsync_yield()
 } while (0)
 #endif
 
+/** Outcomes which can be counted with fzsync_pair_count() */
+enum fzsync_outcome {
+	/** The race was reproduced */
+	FZSYNC_HIT,
+	/** A's critical section ended before B's started */
+	FZSYNC_BEFORE,
+	/** The critical sections overlapped */
+	FZSYNC_OVERLAP,
+	/** B's critical section ended before A's started */
+	FZSYNC_AFTER,
+	/** The number of outcome counters in each pair */
+	FZSYNC_MAX_OUTCOMES
+};
+
+/**
+ * Where fzsync_pair_reset() places threads A and B
+ *
+ * @sa fzsync_place()
+ */
+enum fzsync_placement {
+	/** Leave it to the scheduler */
+	FZSYNC_PLACE_ANY,
+	/** Both threads on the same CPU */
+	FZSYNC_PLACE_SAME_CPU,
+	/** On SMT siblings, i.e. the same core */
+	FZSYNC_PLACE_SMT,
+	/** On different cores sharing the last level cache */
+	FZSYNC_PLACE_LLC,
+	/** On cores which don't share the last level cache */
+	FZSYNC_PLACE_CROSS_LLC,
+	/** On the CPUs with the lowest fzsync_latency_probe() time */
+	FZSYNC_PLACE_FASTEST,
+	/** The number of placements */
+	FZSYNC_PLACE_MAX
+};
+
+/** The maximum number of race attempts in a batch */
+#define FZSYNC_MAX_BATCH 64
+
+/** The timings of one thread in one attempt of a batch */
+struct fzsync_times {
+	struct timespec start;
+	struct timespec end;
+	/** The thread arrived after its scheduled start time */
+	int late;
+	/** Spins spent waiting for the other thread at the end */
+	int spins;
+};
+
+/** To store the run_b pointer and pass to fzsync_thread_wrapper */
+struct fzsync_run_thread {
+	void *(*func)(void *);
+	void *arg;
+	/** Set once func has returned */
+	int done;
+	/** The task id of the thread, used in watchdog reports */
+	pid_t tid;
+};
+
 /** Some statistics for a variable */
 struct fzsync_stat {
 	float avg;
@@ -117,6 +194,49 @@ struct fzsync_stat {
 	float dev_ratio;
 };
 
+/** The maximum depth of the PCT mode */
+#define FZSYNC_PCT_MAX_DEPTH 8
+
+/** The maximum number of intermediate sync points in a race */
+#define FZSYNC_MAX_PHASES 4
+
+/**
+ * An intermediate sync point and the part of the race following it
+ *
+ * @sa fzsync_phase_a()
+ */
+struct fzsync_phase {
+	/** When each thread arrived at the sync point */
+	struct timespec a_arrive, b_arrive;
+	/** When each thread left the sync point after its delay */
+	struct timespec a_start, b_start;
+	/** Avg. time from leaving the sync point to the next one or the end */
+	struct fzsync_stat diff_sa, diff_sb;
+	/** The delay in spins, positive delays B and negative A */
+	int delay;
+};
+
+/** The number of marks each thread can record in a race */
+#define FZSYNC_MAX_MARKS 8
+
+/** The maximum number of race regions in each pair */
+#define FZSYNC_MAX_REGIONS 8
+
+/**
+ * The saved state of a race region which is not currently running
+ *
+ * @sa fzsync_start_region_a()
+ */
+struct fzsync_region {
+	struct fzsync_stat diff_ss;
+	struct fzsync_stat diff_sa;
+	struct fzsync_stat diff_sb;
+	struct fzsync_stat diff_ab;
+	struct fzsync_stat spins_avg;
+	int sampling;
+	int delay_bias;
+};
+
 /**
  * The state of a two way synchronisation or race.
  *
@@ -188,6 +308,60 @@ struct fzsync_pair {
 	 * 0.1, so this allows an average deviation of at most 10%.
 	 */
 	float max_dev_ratio;
+	/**
+	 * Path to an optional timing profile cache
+	 *
+	 * If set, fzsync_pair_reset() will look for a profile matching
+	 * profile_name, the CPU model and the kernel release. If one is
+	 * found the statistics are warm-started from it and only
+	 * profile_samples are needed to verify them. The profile is
+	 * (re)written when the sampling period ends.
+	 *
+	 * @sa fzsync_profile_load()
+	 */
+	const char *profile_path;
+	/**
+	 * The name used to key the profile
+	 *
+	 * Defaults to the process name. Tests which perform multiple
+	 * different races should set a name for each one.
+	 */
+	const char *profile_name;
+	/**
+	 * The minimum number of samples used to verify a loaded profile
+	 *
+	 * Defaults to min_samples / 16.
+	 */
+	int profile_samples;
+	/**
+	 * Path to an optional checkpoint file
+	 *
+	 * If set, the accumulated state of the pair is saved to it every
+	 * checkpoint_interval seconds, when the time limit is reached or
+	 * when SIGTERM is received. fzsync_pair_reset() resumes from it if
+	 * it exists. The file is removed once exec_loops is reached.
+	 *
+	 * @sa fzsync_checkpoint_save()
+	 */
+	const char *checkpoint_path;
+	/**
+	 * The number of seconds between periodic checkpoints
+	 *
+	 * Defaults to zero which disables periodic checkpoints.
+	 */
+	float checkpoint_interval;
+	/** Internal; When the last checkpoint was written */
+	struct timespec checkpoint_time;
+	/** Internal; The state of the delay's random number generator */
+	unsigned short rand_state[3];
+	/** Internal; Counters incremented by fzsync_pair_count() */
+	long outcomes[FZSYNC_MAX_OUTCOMES];
+	/** Internal; fzsync_sigterm_setup() replaced sigterm_old */
+	int sigterm_set;
+	/** Internal; The SIGTERM action to restore on cleanup */
+	struct sigaction sigterm_old;
+	/** Internal; The statistics and delay bias came from the profile */
+	int profile_loaded;
 
 	/** Internal; Atomic counter used by fzsync_pair_wait() */
 	int a_cntr;
@@ -195,6 +369,13 @@ struct fzsync_pair {
 	int b_cntr;
 	/** Internal; Used by fzsync_pair_exit() and fzsync_pair_wait() */
 	int exit;
+	/**
+	 * Internal; Set by thread B once it has seen exit or returned
+	 *
+	 * This is in the pair, rather than the fzsync_run_thread, so that
+	 * it also works when the caller starts thread B itself.
+	 */
+	int b_done;
 	/**
 	 * The maximum desired execution time
 	 *
@@ -213,6 +394,295 @@ struct fzsync_pair {
 	int exec_loop;
 	/** Internal; The second thread or 0 */
 	pthread_t thread_b;
+	/** Internal; The function and argument thread B is started with */
+	struct fzsync_run_thread wrap_run_b;
+	/**
+	 * Start thread B as a process with clone(2)
+	 *
+	 * Thread B only shares the pair with thread A through memory, so
+	 * either the pair must come from fzsync_pair_mmap() or clone_flags
+	 * must include CLONE_VM.
+	 *
+	 * @sa fzsync_clone_b()
+	 */
+	int clone_b;
+	/**
+	 * Flags added to SIGCHLD when cloning thread B
+	 *
+	 * For example CLONE_VM or CLONE_FILES. Defaults to zero which is
+	 * equivalent to fork().
+	 */
+	int clone_flags;
+	/** Internal; The pair was allocated by fzsync_pair_mmap() */
+	int shared;
+	/** Internal; The pid of thread B when it is a process or 0 */
+	pid_t pid_b;
+	/** Internal; Thread A's task id */
+	pid_t a_tid;
+	/** Internal; The stack thread B's process was started on */
+	void *stack_b;
+	/**
+	 * Keep thread B between resets
+	 *
+	 * Thread B is started once and parks when a run ends.
+	 * fzsync_pair_reset() hands it the next run_b and argument. Clear
+	 * this before the final fzsync_pair_cleanup() to stop it.
+	 *
+	 * @sa fzsync_worker_main()
+	 */
+	int persistent;
+	/** Internal; Thread B is a persistent worker */
+	int worker;
+	/** Internal; The number of runs handed to the worker */
+	int worker_run;
+	/** Internal; The number of runs the worker has finished */
+	int worker_done;
+	/** Internal; Tells the worker to return instead of parking */
+	int worker_quit;
+	/** Internal; Protects the worker fields */
+	pthread_mutex_t worker_lock;
+	/** Internal; Signals a new run or a finished one */
+	pthread_cond_t worker_cond;
+	/**
+	 * Report iterations which take this many times the race window
+	 *
+	 * Defaults to zero which disables the watchdog.
+	 *
+	 * @sa fzsync_watchdog_main()
+	 */
+	float watchdog;
+	/** Abort the process after the watchdog reports an iteration */
+	int watchdog_abort;
+	/** Internal; The watchdog thread or 0 */
+	pthread_t watchdog_thread;
+	/** Internal; Tells the watchdog thread to return */
+	int watchdog_stop;
+	/** Internal; The number of iterations the watchdog reported */
+	int watchdog_reports;
+	/** Internal; The longer average race window in ns, for the watchdog */
+	int watchdog_window;
+	/** Internal; Thread A is inside fzsync_loop_a() */
+	int a_looping;
+	/** Internal; Thread B is inside fzsync_loop_b() */
+	int b_looping;
+	/**
+	 * The number of race attempts in each batch
+	 *
+	 * Used by the time-triggered and batched modes. Defaults to 32.
+	 *
+	 * @sa fzsync_tt_run_a(), fzsync_batch_run_a()
+	 */
+	int batch;
+	/** Internal; The number of attempts in the current batch */
+	int batch_len;
+	/** Internal; Thread A's attempt in the current batch or -1 */
+	int a_attempt;
+	/** Internal; Thread B's attempt in the current batch or -1 */
+	int b_attempt;
+	/** Internal; The delay for each attempt in the current batch */
+	int batch_delays[FZSYNC_MAX_BATCH];
+	/** Internal; Thread A's timings in the current batch */
+	struct fzsync_times a_times[FZSYNC_MAX_BATCH];
+	/** Internal; Thread B's timings in the current batch */
+	struct fzsync_times b_times[FZSYNC_MAX_BATCH]
+		__attribute__((aligned(64)));
+	/**
+	 * How far in the future to release both threads from the start
+	 * of race barrier in nanoseconds
+	 *
+	 * Defaults to zero which disables the timed release.
+	 *
+	 * @sa fzsync_start_race_a()
+	 */
+	int release_lead;
+	/** Internal; The release time published by the last arriver */
+	long long release;
+	/** Internal; Counts arrivals at the start of race barrier */
+	int arrivals;
+	/** Internal; The delay converted to nanoseconds */
+	long long delay_ns;
+	/** Internal; Thread A's sequence number used by fzsync_seq_wait() */
+	int a_seq;
+	/** Internal; Thread B's sequence number used by fzsync_seq_wait() */
+	int b_seq __attribute__((aligned(64)));
+	/** Internal; When the first attempt of the batch starts in ns */
+	long long tt_t0;
+	/** Internal; The time between each attempt's start in ns */
+	float tt_period;
+	/** Internal; Set by fzsync_tt_run_a() */
+	int tt;
+	/**
+	 * The nice value of the controller thread
+	 *
+	 * Defaults to zero, which leaves it at the same priority as
+	 * thread A.
+	 *
+	 * @sa fzsync_ctl_run_a()
+	 */
+	int controller_nice;
+	/** Internal; The controller thread or 0 */
+	pthread_t ctl_thread;
+	/** Internal; Tells the controller thread to return */
+	int ctl_stop;
+	/** Internal; The controller's exit decision */
+	int ctl_exit __attribute__((aligned(64)));
+	/** Internal; The last loop the controller has read */
+	int ctl_seq;
+	/** Internal; Loops whose slots were reused before they were read */
+	int ctl_lost;
+	/** Internal; The last loop thread A has finished */
+	int ctl_a_done __attribute__((aligned(64)));
+	/** Internal; The delay thread A handed to thread B */
+	int ctl_delay;
+	/** Internal; The last loop thread B has finished */
+	int ctl_b_done __attribute__((aligned(64)));
+	/** Internal; The loop thread B is in */
+	int ctl_b_loop;
+	/** Internal; Set by fzsync_up_run_a() */
+	int up;
+	/** Internal; The thread allowed to run in uniprocessor mode */
+	int up_turn;
+	/** Internal; Threads A and B are SCHED_FIFO */
+	int up_fifo;
+	/** Internal; The thread with the higher priority or -1 */
+	int up_leader;
+	/** Internal; The time taken by one delay loop in nanoseconds */
+	float up_spin_ns;
+	/** Internal; Thread A's scheduling policy before uniprocessor mode */
+	int up_policy;
+	/** Internal; Thread A's scheduling parameters before uniprocessor mode */
+	struct sched_param up_param;
+	/**
+	 * The depth of the bugs targeted by the PCT mode
+	 *
+	 * Each race has pct_depth - 1 priority change points. Defaults
+	 * to 3.
+	 *
+	 * @sa fzsync_pct_run_a()
+	 */
+	int pct_depth;
+	/** Internal; Set by fzsync_pct_run_a() */
+	int pct;
+	/** Internal; The priorities of threads A and B */
+	int pct_prio[2];
+	/** Internal; The steps at which the running thread's priority drops */
+	int pct_change[FZSYNC_PCT_MAX_DEPTH];
+	/** Internal; The steps taken in the current race */
+	int pct_step;
+	/** Internal; The most steps taken in one race */
+	int pct_steps;
+	/** Internal; Threads A and B have finished the current race */
+	int pct_done[2];
+	/**
+	 * Called by the timer's signal handler in timer mode
+	 *
+	 * Takes the place of thread B's race, so it must be
+	 * async-signal-safe. May be NULL if the delivery of the signal is
+	 * the event being raced.
+	 *
+	 * @sa fzsync_tm_run_a()
+	 */
+	void (*timer_event)(void *arg);
+	/** The argument passed to timer_event */
+	void *timer_arg;
+	/**
+	 * The signal sent by the timer in timer mode
+	 *
+	 * Defaults to SIGRTMIN.
+	 */
+	int timer_signal;
+	/** Internal; Set by fzsync_tm_run_a() */
+	int tm;
+	/** Internal; The timer which replaces thread B */
+	timer_t tm_timer;
+	/** Internal; The timer's signal handler has run in this loop */
+	int tm_fired;
+	/** Internal; The timer fires after thread A's race in this loop */
+	int tm_sample;
+	/** Internal; When the timer was set to expire in ns */
+	long long tm_expiry;
+	/** Internal; Avg. time between the expiry and thread A being interrupted */
+	struct fzsync_stat tm_latency;
+	/** Internal; The region whose state is in the fields above */
+	int region;
+	/** Internal; The region passed to fzsync_start_region_a() */
+	int region_next;
+	/** Internal; The saved state of the other regions */
+	struct fzsync_region regions[FZSYNC_MAX_REGIONS];
+	/** Internal; The number of phases used by thread A in the last race */
+	int phase_n;
+	/** Internal; The state of each phase */
+	struct fzsync_phase phases[FZSYNC_MAX_PHASES];
+	/** Internal; Set by fzsync_pair_align() */
+	int align;
+	/** Internal; The mark in thread A to align */
+	int align_a;
+	/** Internal; The mark in thread B to align */
+	int align_b;
+	/** Internal; Avg. difference between a_start and mark align_a */
+	struct fzsync_stat diff_ma;
+	/** Internal; Avg. difference between b_start and mark align_b */
+	struct fzsync_stat diff_mb;
+	/** Internal; Times recorded by fzsync_mark_a() */
+	struct timespec a_marks[FZSYNC_MAX_MARKS];
+	/** Internal; Times recorded by fzsync_mark_b() */
+	struct timespec b_marks[FZSYNC_MAX_MARKS] __attribute__((aligned(64)));
+	/** Internal; Set by fzsync_cs_enter_a() */
+	int cs;
+	/** Internal; The classification of the last race */
+	enum fzsync_outcome cs_outcome;
+	/** Internal; When thread A entered its critical section */
+	struct timespec a_cs_enter;
+	/** Internal; When thread A left its critical section */
+	struct timespec a_cs_exit;
+	/** Internal; When thread B entered its critical section */
+	struct timespec b_cs_enter __attribute__((aligned(64)));
+	/** Internal; When thread B left its critical section */
+	struct timespec b_cs_exit;
+	/**
+	 * Where to place threads A and B
+	 *
+	 * Defaults to FZSYNC_PLACE_ANY which leaves it to the scheduler.
+	 *
+	 * @sa fzsync_place()
+	 */
+	enum fzsync_placement placement;
+	/**
+	 * Move to the next placement every placement_loops loops
+	 *
+	 * Each placement is sampled again and its loops and hits are
+	 * printed by fzsync_pair_info(). Defaults to zero which disables
+	 * the rotation.
+	 */
+	int placement_loops;
+	/**
+	 * Path to an optional cache of the latencies between CPUs
+	 *
+	 * Used by FZSYNC_PLACE_FASTEST. See fzsync_latency_fastest().
+	 */
+	const char *latency_path;
+	/** Internal; The current placement */
+	enum fzsync_placement place;
+	/** Internal; The CPU thread A is pinned to or -1 */
+	int cpu_a;
+	/** Internal; The CPU thread B is pinned to or -1 */
+	int cpu_b;
+	/** Internal; Thread A's CPU of the fastest pair found so far or -1 */
+	int fastest_a;
+	/** Internal; Thread B's CPU of the fastest pair found so far or -1 */
+	int fastest_b;
+	/** Internal; The loop when the placement was last accounted */
+	int place_loop;
+	/** Internal; The hits when the placement was last accounted */
+	long place_hit;
+	/** Internal; The loops run in each placement */
+	long place_loops[FZSYNC_PLACE_MAX];
+	/** Internal; The hits counted in each placement */
+	long place_hits[FZSYNC_PLACE_MAX];
+	/** Internal; Thread A was pinned and a_affinity is set */
+	int a_placed;
+	/** Internal; Thread A's affinity before it was pinned */
+	unsigned long a_affinity[1024 / (8 * sizeof(unsigned long))];
 };
 
 #define CHK(param, low, hi, def) do {					\
@@ -230,13 +700,26 @@ struct fzsync_pair {
  *
  * @sa fzsync_pair_reset()
  */
-static void fzsync_pair_init(struct fzsync_pair *pair)
+static inline void fzsync_pair_init(struct fzsync_pair *pair)
 {
 	CHK(avg_alpha, FLT_MIN, 1, 0.25);
 	CHK(min_samples, 20, INT_MAX, 1024);
 	CHK(max_dev_ratio, FLT_MIN, 1, 0.1);
 	CHK(exec_time, 1, FLT_MAX, 150);
 	CHK(exec_loops, 20, INT_MAX, 3000000);
+	CHK(profile_samples, 1, pair->min_samples,
+	    MAX(pair->min_samples / 16, 20));
+	CHK(batch, 1, FZSYNC_MAX_BATCH, 32);
+	CHK(placement, 0, FZSYNC_PLACE_MAX - 1, FZSYNC_PLACE_ANY);
+	CHK(placement_loops, 0, INT_MAX, 0);
+	CHK(watchdog, 0, FLT_MAX, 0);
+	CHK(controller_nice, -20, 19, 0);
+	CHK(timer_signal, SIGRTMIN, SIGRTMAX, SIGRTMIN);
+	CHK(pct_depth, 1, FZSYNC_PCT_MAX_DEPTH, 3);
+	assert(!pair->persistent || !pair->clone_b);
+
+	pair->fastest_a = -1;
+	pair->fastest_b = -1;
 }
 #undef CHK
 
@@ -262,60 +745,107 @@ static inline int fzsync_atomic_inc(int *v)
 	return fzsync_atomic_add_return(1, v);
 }
 
+static inline long fzsync_atomic_load_long(long *v)
+{
+	return __atomic_load_n(v, __ATOMIC_SEQ_CST);
+}
+
 /**
- * Exit and join thread B if necessary.
- *
- * @relates fzsync_pair
- * @returns The result of pthread_join()
+ * Increment a counter which has one writer, but may be read by another
  *
- * Call this from your cleanup function.
+ * No locked instruction is needed because only the calling thread
+ * writes to the counter. The store just has to be atomic, so that the
+ * controller thread never sees a torn value.
  */
-static int fzsync_pair_cleanup(struct fzsync_pair *pair)
+static inline void fzsync_counter_inc(long *v)
 {
-	int rval = 0;
-
-	if (pair->thread_b) {
-		/* Revoke thread B if parent hits accidental break */
-		if (!pair->exit) {
-			fzsync_atomic_store(1, &pair->exit);
-			usleep(100000);
-			pthread_cancel(pair->thread_b);
-		}
-		rval = pthread_join(pair->thread_b, NULL);
-		pair->thread_b = 0;
-	}
-
-	return rval;
+	__atomic_store_n(v, *v + 1, __ATOMIC_RELAXED);
 }
 
-/** To store the run_b pointer and pass to fzsync_thread_wrapper */
-struct fzsync_run_thread {
-	void *(*func)(void *);
-	void *arg;
-};
+/**
+ * Whether an exit has been requested
+ *
+ * @param exit A pointer to the exit flag or NULL
+ */
+static inline int fzsync_exiting(int *exit)
+{
+	return exit && fzsync_atomic_load(exit);
+}
 
 /**
- * Wrap run_b for fzsync_pair_reset to enable pthread cancel
- * at the start of the thread B.
+ * Wait for the other thread or an exit request
+ *
+ * @relates fzsync_pair
+ * @param exit A pointer to the exit flag or NULL
+ *
+ * The same as fzsync_pair_wait(), except that it stops waiting once
+ * *exit is set. Used by thread B, so that it notices thread A leaving
+ * early even if thread A never reaches the barrier.
  */
-static void *fzsync_thread_wrapper(void *run_thread)
+static inline void fzsync_pair_wait_exit(int *our_cntr, int *other_cntr,
+					 int *spins, int *exit)
 {
-       struct fzsync_run_thread t = *(struct fzsync_run_thread *)run_thread;
+	if (fzsync_atomic_inc(other_cntr) == INT_MAX) {
+		/*
+		 * We are about to break the invariant that the thread with
+		 * the lowest count is in front of the other. So we must wait
+		 * here to ensure the other thread has at least reached the
+		 * line above before doing that. If we are in rear position
+		 * then our counter may already have been set to zero.
+		 */
+		while (fzsync_atomic_load(our_cntr) > 0
+		       && fzsync_atomic_load(our_cntr) < INT_MAX
+		       && !fzsync_exiting(exit)) {
+			if (spins)
+				(*spins)++;
+
+			fzsync_yield();
+		}
+
+		fzsync_atomic_store(0, other_cntr);
+		/*
+		 * Once both counters have been set to zero the invariant
+		 * is restored and we can continue.
+		 */
+		while (fzsync_atomic_load(our_cntr) > 1
+		       && !fzsync_exiting(exit))
+			fzsync_yield();
+	} else {
+		/*
+		 * If our counter is less than the other thread's we are ahead
+		 * of it and need to wait.
+		 */
+		while (fzsync_atomic_load(our_cntr) < fzsync_atomic_load(other_cntr)
+		       && !fzsync_exiting(exit)) {
+			if (spins)
+				(*spins)++;
 
-       pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-       pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-       return t.func(t.arg);
+			fzsync_yield();
+		}
+	}
 }
 
 /**
- * Zero some stat fields
+ * Wait for the other thread
  *
- * @relates fzsync_stat
+ * @relates fzsync_pair
+ * @param our_cntr The counter for the thread we are on
+ * @param other_cntr The counter for the thread we are synchronising with
+ * @param spins A pointer to the spin counter or NULL
+ *
+ * Used by fzsync_pair_wait_a(), fzsync_pair_wait_b(),
+ * fzsync_start_race_a(), etc. If the calling thread is ahead of the other
+ * thread, then it will spin wait. Unlike pthread_barrier_wait it will never
+ * use futex and can count the number of spins spent waiting.
+ *
+ * @return A non-zero value if the thread should continue otherwise the
+ * calling thread should exit.
  */
-static void fzsync_init_stat(struct fzsync_stat *s)
+static inline void fzsync_pair_wait(int *our_cntr,
+					int *other_cntr,
+					int *spins)
 {
-	s->avg = 0;
-	s->avg_dev = 0;
+	fzsync_pair_wait_exit(our_cntr, other_cntr, spins, NULL);
 }
 
 /**
@@ -331,6 +861,12 @@ static inline long fzsync_diff_ns(struct timespec t1, struct timespec t2)
 	return res + (t1.tv_nsec - t2.tv_nsec);
 }
 
+/** Convert a timespec to nanoseconds */
+static inline long long fzsync_ts_ns(struct timespec t)
+{
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
 /** Wraps clock_gettime */
 static inline int fzsync_time(struct timespec *t)
 {
@@ -341,544 +877,5673 @@ static inline int fzsync_time(struct timespec *t)
 #endif
 }
 
+/** Set by fzsync_sigterm_handler() when SIGTERM is received */
+static volatile sig_atomic_t fzsync_sigterm;
+
+static void fzsync_sigterm_handler(int sig)
+{
+	(void)sig;
+	fzsync_sigterm = 1;
+}
+
 /**
- * Approximately return the time remaining in seconds
+ * Install fzsync_sigterm_handler() unless SIGTERM is already handled
  *
- * If less than a second is remaining we round up to 1
+ * @relates fzsync_pair
+ * @sa fzsync_sigterm_restore()
  */
-static long fzsync_timeout_remaining(const struct fzsync_pair *pair)
+static void fzsync_sigterm_setup(struct fzsync_pair *pair)
 {
-	static struct timespec now;
-	long res = pair->exec_time;
+	struct sigaction sa;
 
-	fzsync_time(&now);
-	assert(now.tv_sec >= pair->exec_time_start.tv_sec);
-	res -= (now.tv_sec - pair->exec_time_start.tv_sec);
+	if (sigaction(SIGTERM, NULL, &pair->sigterm_old)
+	    || pair->sigterm_old.sa_handler != SIG_DFL)
+		return;
 
-	if (res > 0)
-		return res;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fzsync_sigterm_handler;
+	sigemptyset(&sa.sa_mask);
+	if (!sigaction(SIGTERM, &sa, NULL))
+		pair->sigterm_set = 1;
+}
 
-	if (res < 0)
-		return 0;
+/**
+ * Restore the SIGTERM action replaced by fzsync_sigterm_setup()
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_sigterm_restore(struct fzsync_pair *pair)
+{
+	if (!pair->sigterm_set)
+		return;
 
-	res = now.tv_nsec - pair->exec_time_start.tv_nsec;
+	sigaction(SIGTERM, &pair->sigterm_old, NULL);
+	pair->sigterm_set = 0;
+}
 
-	if (res > 0)
-		return 1;
+#ifndef sigev_notify_thread_id
+# define sigev_notify_thread_id _sigev_un._tid
+#endif
 
-	return 0;
+/** Serialises installing and restoring the timer mode signal handler */
+static pthread_mutex_t fzsync_tm_lock = PTHREAD_MUTEX_INITIALIZER;
+/** The number of pairs in timer mode */
+static int fzsync_tm_users;
+/** The signal the handler is installed for while fzsync_tm_users > 0 */
+static int fzsync_tm_signal;
+/** The action of fzsync_tm_signal before the first pair used it */
+static struct sigaction fzsync_tm_old;
+
+/**
+ * Run the timer mode event in place of thread B
+ *
+ * Records thread B's start and end times around timer_event. The pair
+ * is passed in the timer's sigev_value, so that several pairs, each
+ * with its own thread A, can be in timer mode at once.
+ */
+static void fzsync_tm_handler(int sig, siginfo_t *si, void *uc)
+{
+	struct fzsync_pair *pair = si->si_value.sival_ptr;
+	int saved_errno = errno;
+
+	(void)sig;
+	(void)uc;
+	if (si->si_code != SI_TIMER || !pair)
+		return;
+
+	fzsync_time(&pair->b_start);
+	if (pair->timer_event)
+		pair->timer_event(pair->timer_arg);
+	fzsync_time(&pair->b_end);
+	fzsync_atomic_store(1, &pair->tm_fired);
+
+	errno = saved_errno;
 }
 
 /**
- * Reset or initialise fzsync.
+ * Restore the signal action once the last pair leaves timer mode
+ */
+static void fzsync_tm_release(void)
+{
+	pthread_mutex_lock(&fzsync_tm_lock);
+	if (!--fzsync_tm_users)
+		sigaction(fzsync_tm_signal, &fzsync_tm_old, NULL);
+	pthread_mutex_unlock(&fzsync_tm_lock);
+}
+
+/**
+ * Install the timer mode signal handler and create the timer
  *
  * @relates fzsync_pair
- * @param pair The state structure initialised with FZSYNC_PAIR_INIT.
- * @param run_b The function defining thread B or NULL.
- * @returns The result of pthread_create, clock_gettime or zero
- *
- * Call this from your main test function (thread A), just before entering the
- * main loop. It will (re)set any variables needed by fzsync and (re)start
- * thread B using the function provided.
- *
- * If you need to use fork or clone to start the second thread/process then
- * you can pass NULL to run_b and handle starting and stopping thread B
- * yourself. You may need to place fzsync_pair in some shared memory as
- * well.
+ * @returns Zero or an error number
  *
- * @sa fzsync_pair_init()
+ * The timer signals the calling thread, which must be thread A. The
+ * handler is installed without SA_RESTART, so a syscall it interrupts
+ * fails with EINTR. The handler is shared by every pair in timer mode,
+ * so they must all use the same timer_signal, otherwise EBUSY is
+ * returned.
  */
-static int fzsync_pair_reset(struct fzsync_pair *pair,
-				  void *(*run_b)(void *))
+static int fzsync_tm_setup(struct fzsync_pair *pair)
 {
+	struct sigaction sa;
+	struct sigevent sev;
+	sigset_t set;
 	int rval = 0;
 
-	fzsync_pair_cleanup(pair);
+	pthread_mutex_lock(&fzsync_tm_lock);
+	if (fzsync_tm_users && fzsync_tm_signal != pair->timer_signal) {
+		rval = EBUSY;
+	} else if (!fzsync_tm_users) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = fzsync_tm_handler;
+		sa.sa_flags = SA_SIGINFO;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(pair->timer_signal, &sa, &fzsync_tm_old))
+			rval = errno;
+		else
+			fzsync_tm_signal = pair->timer_signal;
+	}
+	if (!rval)
+		fzsync_tm_users++;
+	pthread_mutex_unlock(&fzsync_tm_lock);
 
-	fzsync_init_stat(&pair->diff_ss);
-	fzsync_init_stat(&pair->diff_sa);
-	fzsync_init_stat(&pair->diff_sb);
-	fzsync_init_stat(&pair->diff_ab);
-	fzsync_init_stat(&pair->spins_avg);
-	pair->delay = 0;
-	pair->sampling = pair->min_samples;
+	if (rval)
+		return rval;
 
-	pair->exec_loop = 0;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = pair->timer_signal;
+	sev.sigev_value.sival_ptr = pair;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(CLOCK_MONOTONIC, &sev, &pair->tm_timer)) {
+		rval = errno;
+		fzsync_tm_release();
+		return rval;
+	}
 
-	pair->a_cntr = 0;
-	pair->b_cntr = 0;
-	pair->exit = 0;
-	if (run_b) {
-		static struct fzsync_run_thread wrap_run_b;
+	sigemptyset(&set);
+	sigaddset(&set, pair->timer_signal);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
 
-		wrap_run_b.func = run_b;
-		wrap_run_b.arg = NULL;
-		rval = pthread_create(&pair->thread_b, 0,
-				      fzsync_thread_wrapper, &wrap_run_b);
+	pair->tm = 1;
 
-		if (rval)
-			return rval;
+	return 0;
+}
+
+/**
+ * Delete the timer and release the signal action
+ *
+ * @relates fzsync_pair
+ *
+ * A signal from a timer which expired before it was deleted has
+ * already been handled by the time timer_delete() returns, because it
+ * is sent to the calling thread.
+ */
+static void fzsync_tm_stop(struct fzsync_pair *pair)
+{
+	if (!pair->tm)
+		return;
+
+	timer_delete(pair->tm_timer);
+	fzsync_tm_release();
+	pair->tm = 0;
+}
+
+/**
+ * Get the CPUs the process may run on
+ *
+ * @returns The number of CPUs written to cpus
+ */
+static int fzsync_cpus(int *cpus, int max)
+{
+	int i, n = 0;
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+
+	if (!sched_getaffinity(0, sizeof(set), &set)) {
+		for (i = 0; i < CPU_SETSIZE && n < max; i++) {
+			if (CPU_ISSET(i, &set))
+				cpus[n++] = i;
+		}
+
+		return n;
 	}
+#endif
 
-	rval = fzsync_time(&pair->exec_time_start);
+	n = MIN((int)sysconf(_SC_NPROCESSORS_ONLN), max);
+	for (i = 0; i < n; i++)
+		cpus[i] = i;
 
-	return rval;
+	return n;
 }
 
 /**
- * Print stat
+ * Pin a thread to a single CPU
  *
- * @relates fzsync_stat
+ * @returns The result of pthread_setaffinity_np() or zero
  */
-static inline void fzsync_stat_info(struct fzsync_stat stat,
-				    char *unit, char *name)
+static int fzsync_pin(pthread_t thread, int cpu)
 {
-	fzsync_printf("%1$-17s: { avg = %3$5.0f%2$s, avg_dev = %4$5.0f%2$s, dev_ratio = %5$.2f }",
-		name, unit, stat.avg, stat.avg_dev, stat.dev_ratio);
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return 0;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+	(void)thread;
+	(void)cpu;
+
+	return 0;
+#endif
 }
 
 /**
- * Print some synchronisation statistics
+ * Name of a placement
  *
  * @relates fzsync_pair
  */
-static void fzsync_pair_info(struct fzsync_pair *pair)
+static inline const char *fzsync_placement_name(enum fzsync_placement place)
 {
-	fzsync_printf("loop = %d, delay_bias = %d",
-		      pair->exec_loop, pair->delay_bias);
-	fzsync_stat_info(pair->diff_ss, "ns", "start_a - start_b");
-	fzsync_stat_info(pair->diff_sa, "ns", "end_a - start_a");
-	fzsync_stat_info(pair->diff_sb, "ns", "end_b - start_b");
-	fzsync_stat_info(pair->diff_ab, "ns", "end_a - end_b");
-	fzsync_stat_info(pair->spins_avg, "  ", "spins");
+	switch (place) {
+	case FZSYNC_PLACE_ANY:
+		return "any";
+	case FZSYNC_PLACE_SAME_CPU:
+		return "same CPU";
+	case FZSYNC_PLACE_SMT:
+		return "SMT siblings";
+	case FZSYNC_PLACE_LLC:
+		return "same LLC";
+	case FZSYNC_PLACE_CROSS_LLC:
+		return "cross LLC";
+	case FZSYNC_PLACE_FASTEST:
+		return "fastest";
+	default:
+		return "?";
+	}
 }
 
 /**
- * Exponential moving average
- *
- * @param alpha The preference for recent samples over old ones.
- * @param sample The current sample
- * @param prev_avg The average of the all the previous samples
+ * Restore thread A's affinity from before it was placed
  *
- * @return The average including the current sample.
+ * @relates fzsync_pair
  */
-static inline float fzsync_exp_moving_avg(float alpha,
-					  float sample,
-					  float prev_avg)
+static void fzsync_place_restore(struct fzsync_pair *pair)
 {
-	return alpha * sample + (1.0 - alpha) * prev_avg;
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+
+	if (pair->a_placed) {
+		CPU_ZERO(&set);
+		memcpy(&set, pair->a_affinity,
+		       MIN(sizeof(set), sizeof(pair->a_affinity)));
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#endif
+	pair->a_placed = 0;
+	pair->cpu_a = -1;
+	pair->cpu_b = -1;
 }
 
 /**
- * Update a stat with a new sample
+ * Add the loops and hits since the last call to the current placement
  *
- * @relates fzsync_stat
+ * @relates fzsync_pair
  */
-static inline void fzsync_upd_stat(struct fzsync_stat *s,
-				   float alpha,
-				   float sample)
+static void fzsync_place_account(struct fzsync_pair *pair)
 {
-	s->avg = fzsync_exp_moving_avg(alpha, sample, s->avg);
-	s->avg_dev = fzsync_exp_moving_avg(alpha,
-					fabs(s->avg - sample), s->avg_dev);
-	s->dev_ratio = fabs(s->avg ? s->avg_dev / s->avg : 0);
+	pair->place_loops[pair->place] += pair->exec_loop - pair->place_loop;
+	pair->place_hits[pair->place] +=
+		pair->outcomes[FZSYNC_HIT] - pair->place_hit;
+	pair->place_loop = pair->exec_loop;
+	pair->place_hit = pair->outcomes[FZSYNC_HIT];
 }
 
 /**
- * Update a stat with a new diff sample
+ * Pin thread B, whether it is a thread or a process
  *
- * @relates fzsync_stat
+ * @relates fzsync_pair
+ * @returns Zero or an error number, zero if there is no thread B
  */
-static inline void fzsync_upd_diff_stat(struct fzsync_stat *s,
-					float alpha,
-					struct timespec t1,
-					struct timespec t2)
+static int fzsync_pin_b(struct fzsync_pair *pair, int cpu)
 {
-	fzsync_upd_stat(s, alpha, fzsync_diff_ns(t1, t2));
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+
+	if (pair->pid_b && cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+
+		return sched_setaffinity(pair->pid_b, sizeof(set), &set) ? errno : 0;
+	}
+#endif
+
+	return pair->thread_b ? fzsync_pin(pair->thread_b, cpu) : 0;
 }
 
+/** Thread A may run in uniprocessor mode */
+#define FZSYNC_UP_A 0
+/** Thread B may run in uniprocessor mode */
+#define FZSYNC_UP_B 1
+/** Both threads may run and the scheduler picks the leader */
+#define FZSYNC_UP_BOTH 2
+/** Thread A has left, thread B must check pair->exit */
+#define FZSYNC_UP_EXIT 3
+
 /**
- * Calculate various statistics and the delay
+ * Wait on or wake the uniprocessor mode turn
  *
- * This function helps create the fuzz in fuzzy sync. Imagine we have the
- * following timelines in threads A and B:
- *
- *  start_race_a
- *      ^                    end_race_a (a)
- *      |                        ^
- *      |                        |
- *  - --+------------------------+-- - -
- *      |        Syscall A       |                 Thread A
- *  - --+------------------------+-- - -
- *  - --+----------------+-------+-- - -
- *      |   Syscall B    | spin  |                 Thread B
- *  - --+----------------+-------+-- - -
- *      |                |
- *      ^                ^
- *  start_race_b     end_race_b
+ * @relates fzsync_pair
  *
- * Here we have synchronised the calls to syscall A and B with start_race_{a,
- * b} so that they happen at approximately the same time in threads A and
- * B. If the race condition occurs during the entry code for these two
- * functions then we will quickly hit it. If it occurs during the exit code of
- * B and mid way through A, then we will quickly hit it.
+ * The private futex operations only work within one address space, so
+ * they are not used when thread B is a process sharing a mapping.
+ */
+static inline void fzsync_up_futex(struct fzsync_pair *pair, int op, int val)
+{
+	if (!pair->shared)
+		op |= FUTEX_PRIVATE_FLAG;
+
+	syscall(SYS_futex, &pair->up_turn, op, val, NULL, NULL, 0);
+}
+
+/**
+ * Give the turn to another thread and wake it
  *
- * However if the exit paths of A and B need to be aligned and (end_race_a -
- * end_race_b) is large relative to the variation in call times, the
- * probability of hitting the race condition is close to zero. To solve this
- * scenario (and others) a randomised delay is introduced before the syscalls
- * in A and B. Given enough time the following should happen where the exit
- * paths are now synchronised:
+ * @relates fzsync_pair
+ */
+static inline void fzsync_up_pass(struct fzsync_pair *pair, int turn)
+{
+	fzsync_atomic_store(turn, &pair->up_turn);
+	fzsync_up_futex(pair, FUTEX_WAKE, 1);
+}
+
+/**
+ * Sleep until it is the given turn
  *
- *  start_race_a
- *      ^                    end_race_a (a)
- *      |                        ^
- *      |                        |
- *  - --+------------------------+-- - -
- *      |        Syscall A       |                 Thread A
- *  - --+------------------------+-- - -
- *  - --+-------+----------------+-- - -
- *      | delay |   Syscall B    |                 Thread B
- *  - --+-------+----------------+-- - -
- *      |                        |
- *      ^                        ^
- *  start_race_b             end_race_b
+ * @relates fzsync_pair
+ * @param exit A pointer to the exit flag or NULL, see fzsync_pair_wait_exit()
  *
- * The delay is not introduced immediately and the delay range is only
- * calculated once the average relative deviation has dropped below some
- * percentage of the total time.
+ * Unlike fzsync_pair_wait() the waiting thread does not spin, so the
+ * CPU is handed straight to the other thread.
+ */
+static inline void fzsync_up_wait(struct fzsync_pair *pair, int turn,
+				  int *exit)
+{
+	int t;
+
+	while ((t = fzsync_atomic_load(&pair->up_turn)) != turn
+	       && !fzsync_exiting(exit))
+		fzsync_up_futex(pair, FUTEX_WAIT, t);
+}
+
+/**
+ * Set the SCHED_FIFO priority of thread A or B
  *
- * The delay range is chosen so that any point in Syscall A could be
- * synchronised with any point in Syscall B using a value from the
- * range. Because the delay range may be too large for a linear search, we use
- * an evenly distributed random function to pick a value from it.
+ * @relates fzsync_pair
+ * @param b Zero for thread A, otherwise thread B
+ * @returns Zero or an error number, ESRCH if thread B was not started
+ *          by the library
+ */
+static int fzsync_up_prio(struct fzsync_pair *pair, int b, int prio)
+{
+	struct sched_param sp = { .sched_priority = prio };
+
+	if (!b)
+		return pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+
+	if (pair->pid_b)
+		return sched_setscheduler(pair->pid_b, SCHED_FIFO, &sp) ? errno : 0;
+
+	if (!pair->thread_b)
+		return ESRCH;
+
+	return pthread_setschedparam(pair->thread_b, SCHED_FIFO, &sp);
+}
+
+/**
+ * Measure the time taken by one delay loop
  *
- * The delay range goes from positive to negative. A negative delay will delay
- * thread A and a positive one will delay thread B. The range is bounded by
- * the point where the entry code to Syscall A is synchronised with the exit
- * to Syscall B and the entry code to Syscall B is synchronised with the exit
- * of A.
+ * The best of a few attempts is used, in case one of them was
+ * preempted.
+ */
+static float fzsync_up_spin_ns(void)
+{
+	struct timespec start, end;
+	volatile int delay;
+	long best = LONG_MAX;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		fzsync_time(&start);
+		for (delay = 1 << 20; delay > 0; delay--)
+			;
+		fzsync_time(&end);
+		best = MIN(best, fzsync_diff_ns(end, start));
+	}
+
+	return MAX(best, 1L) / (float)(1 << 20);
+}
+
+/**
+ * Switch threads A and B to SCHED_FIFO if it is permitted
  *
- * In order to calculate the lower bound (the max delay of A) we can simply
- * negate the execution time of Syscall B and convert it to a spin count. For
- * the upper bound (the max delay of B), we just take the execution time of A
- * and convert it to a spin count.
+ * @relates fzsync_pair
+ */
+static void fzsync_up_setup(struct fzsync_pair *pair)
+{
+	int rval;
+
+	pair->up = 1;
+	pair->up_leader = -1;
+	if (!pair->up_spin_ns)
+		pair->up_spin_ns = fzsync_up_spin_ns();
+
+	pthread_getschedparam(pthread_self(), &pair->up_policy, &pair->up_param);
+
+	rval = fzsync_up_prio(pair, 0, 1);
+	if (!rval)
+		rval = fzsync_up_prio(pair, 1, 1);
+
+	pair->up_fifo = !rval;
+	if (rval) {
+		fzsync_printf("Can't use SCHED_FIFO (%s), the scheduler decides when the delayed thread runs",
+			      strerror(rval));
+		pthread_setschedparam(pthread_self(), pair->up_policy,
+				      &pair->up_param);
+	}
+}
+
+/**
+ * Restore the scheduling policy of thread A and any persistent thread B
  *
- * In order to calculate spin count we need to know approximately how long a
- * spin takes and divide the delay time with it. We find this by first
- * counting how many spins one thread spends waiting for the other during
- * end_race[1]. We also know when each syscall exits so we can take the
- * difference between the exit times and divide it with the number of spins
- * spent waiting.
+ * @relates fzsync_pair
+ */
+static void fzsync_up_restore(struct fzsync_pair *pair)
+{
+	if (pair->up_fifo) {
+		pthread_setschedparam(pthread_self(), pair->up_policy,
+				      &pair->up_param);
+		if (pair->worker) {
+			pthread_setschedparam(pair->thread_b, pair->up_policy,
+					      &pair->up_param);
+		}
+	}
+
+	pair->up = 0;
+	pair->up_fifo = 0;
+}
+
+/** The size of the stack thread B's process is started on */
+#define FZSYNC_CLONE_STACK (1 << 20)
+
+/**
+ * How long thread B is given to exit after thread A leaves early
  *
- * All the times and counts we use in the calculation are averaged over a
- * variable number of iterations. There is an initial sampling period where we
- * simply collect time and count samples then calculate their averages. When a
- * minimum number of samples have been collected, and if the average deviation
- * is below some proportion of the average sample magnitude, then the sampling
- * period is ended. On all further iterations a random delay is calculated and
- * applied, but the averages are not updated.
+ * Thread B's waits stop as soon as pair->exit is set, so it is only
+ * killed or cancelled if it is stuck elsewhere.
+ */
+#define FZSYNC_EXIT_NS 100000000
+
+/**
+ * Wait for a thread to set its done flag
  *
- * [1] This assumes there is always a significant difference. The algorithm
- * may fail to introduce a delay (when one is needed) in situations where
- * Syscall A and B finish at approximately the same time.
+ * @returns Non-zero if it did so within FZSYNC_EXIT_NS
+ */
+static int fzsync_wait_done(int *done)
+{
+	struct timespec start, now;
+
+	fzsync_time(&start);
+	while (!fzsync_atomic_load(done)) {
+		fzsync_time(&now);
+		if (fzsync_diff_ns(now, start) > FZSYNC_EXIT_NS)
+			return 0;
+
+		fzsync_yield();
+	}
+
+	return 1;
+}
+
+/**
+ * Wait for thread B's process to exit
  *
  * @relates fzsync_pair
+ * @returns Zero or the error number from waitpid()
+ *
+ * If thread A has not requested an exit, it is requested now and the
+ * process is killed if it has not exited within FZSYNC_EXIT_NS. It is
+ * reported if thread B died from any other signal or failed, as this
+ * may be the result of the race.
  */
-static void fzsync_pair_update(struct fzsync_pair *pair)
+static int fzsync_reap_b(struct fzsync_pair *pair)
 {
-	float alpha = pair->avg_alpha;
-	float per_spin_time, time_delay;
-	float max_dev = pair->max_dev_ratio;
-	int over_max_dev;
+	int status, killed = 0, rval = 0;
+	struct timespec start, now;
+	pid_t pid = 0;
 
-	pair->delay = pair->delay_bias;
+	if (!pair->exit) {
+		fzsync_atomic_store(1, &pair->exit);
+		if (pair->up || pair->pct)
+			fzsync_up_pass(pair, FZSYNC_UP_EXIT);
 
-	over_max_dev = pair->diff_ss.dev_ratio > max_dev
-		|| pair->diff_sa.dev_ratio > max_dev
-		|| pair->diff_sb.dev_ratio > max_dev
-		|| pair->diff_ab.dev_ratio > max_dev
-		|| pair->spins_avg.dev_ratio > max_dev;
-
-	if (pair->sampling > 0 || over_max_dev) {
-		fzsync_upd_diff_stat(&pair->diff_ss, alpha,
-				  pair->a_start, pair->b_start);
-		fzsync_upd_diff_stat(&pair->diff_sa, alpha,
-				  pair->a_end, pair->a_start);
-		fzsync_upd_diff_stat(&pair->diff_sb, alpha,
-				  pair->b_end, pair->b_start);
-		fzsync_upd_diff_stat(&pair->diff_ab, alpha,
-				  pair->a_end, pair->b_end);
-		fzsync_upd_stat(&pair->spins_avg, alpha, pair->spins);
-		if (pair->sampling > 0 && --pair->sampling == 0) {
-			fzsync_printf("Minimum sampling period ended");
-			fzsync_pair_info(pair);
+		fzsync_time(&start);
+		while (!(pid = waitpid(pair->pid_b, &status, WNOHANG))) {
+			fzsync_time(&now);
+			if (fzsync_diff_ns(now, start) > FZSYNC_EXIT_NS)
+				break;
+
+			usleep(100);
 		}
-	} else if (fabsf(pair->diff_ab.avg) >= 1) {
-		per_spin_time = fabsf(pair->diff_ab.avg) / MAX(pair->spins_avg.avg, 1.0f);
-		time_delay = drand48() * (pair->diff_sa.avg + pair->diff_sb.avg)
-			- pair->diff_sb.avg;
-		pair->delay += (int)(1.1 * time_delay / per_spin_time);
 
-		if (!pair->sampling) {
-			fzsync_printf("Reached deviation ratios < %.2f, introducing randomness",
-				      pair->max_dev_ratio);
-			fzsync_printf("Delay range is [%d, %d]",
-				      -(int)(pair->diff_sb.avg / per_spin_time) + pair->delay_bias,
-				      (int)(pair->diff_sa.avg / per_spin_time) + pair->delay_bias);
-			fzsync_pair_info(pair);
-			pair->sampling = -1;
-		}
-	} else if (!pair->sampling) {
-		fzsync_printf("Can't calculate random delay");
-		fzsync_pair_info(pair);
-		pair->sampling = -1;
+		if (!pid) {
+			kill(pair->pid_b, SIGKILL);
+			killed = 1;
+		}
+	}
+
+	while (!pid || (pid < 0 && errno == EINTR))
+		pid = waitpid(pair->pid_b, &status, 0);
+
+	if (pid < 0) {
+		rval = errno;
+	} else if (WIFSIGNALED(status) && !killed) {
+		fzsync_printf("Thread B (pid %d) was killed by %s",
+			      pair->pid_b, strsignal(WTERMSIG(status)));
+	} else if (WIFEXITED(status) && WEXITSTATUS(status)) {
+		fzsync_printf("Thread B (pid %d) exited with %d",
+			      pair->pid_b, WEXITSTATUS(status));
+	}
+
+	munmap(pair->stack_b, FZSYNC_CLONE_STACK);
+	pair->stack_b = NULL;
+	pair->pid_b = 0;
+
+	return rval;
+}
+
+/**
+ * Wait for the persistent worker to finish its run and park
+ *
+ * @relates fzsync_pair
+ * @returns Zero or the result of pthread_join()
+ *
+ * The exit is requested if thread A has not done so. If the worker has
+ * not finished within FZSYNC_EXIT_NS, or persistent has been cleared,
+ * it is told to quit, cancelled if it is still running and joined.
+ */
+static int fzsync_worker_park(struct fzsync_pair *pair)
+{
+	struct timespec deadline;
+	int rval = 0, quit;
+
+	pthread_mutex_lock(&pair->worker_lock);
+	if (pair->worker_done != pair->worker_run) {
+		fzsync_atomic_store(1, &pair->exit);
+		if (pair->up || pair->pct)
+			fzsync_up_pass(pair, FZSYNC_UP_EXIT);
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += FZSYNC_EXIT_NS;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+
+		while (pair->worker_done != pair->worker_run && !rval) {
+			rval = pthread_cond_timedwait(&pair->worker_cond,
+						      &pair->worker_lock,
+						      &deadline);
+		}
+	}
+
+	quit = !pair->persistent || rval;
+	if (quit) {
+		pair->worker_quit = 1;
+		pthread_cond_broadcast(&pair->worker_cond);
+	}
+	pthread_mutex_unlock(&pair->worker_lock);
+
+	if (!quit)
+		return 0;
+
+	if (rval)
+		pthread_cancel(pair->thread_b);
+	rval = pthread_join(pair->thread_b, NULL);
+	pthread_mutex_destroy(&pair->worker_lock);
+	pthread_cond_destroy(&pair->worker_cond);
+	pair->thread_b = 0;
+	pair->worker = 0;
+
+	return rval;
+}
+
+/**
+ * The shortest time without progress reported by the watchdog
+ *
+ * The race window is often only microseconds long, but an iteration
+ * may be delayed by much more than that on a busy machine.
+ */
+#ifndef FZSYNC_WATCHDOG_MIN_NS
+# define FZSYNC_WATCHDOG_MIN_NS 1000000000LL
+#endif
+
+/** How often the watchdog checks for progress */
+#define FZSYNC_WATCHDOG_POLL_NS (FZSYNC_WATCHDOG_MIN_NS / 10)
+
+/** The number of counters the watchdog watches for progress */
+#define FZSYNC_WATCHDOG_COUNTERS 7
+
+/**
+ * Read the counters which change whenever either thread progresses
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_watchdog_progress(struct fzsync_pair *pair, int *c)
+{
+	c[0] = fzsync_atomic_load(&pair->exec_loop);
+	c[1] = fzsync_atomic_load(&pair->a_cntr);
+	c[2] = fzsync_atomic_load(&pair->b_cntr);
+	c[3] = fzsync_atomic_load(&pair->a_seq);
+	c[4] = fzsync_atomic_load(&pair->b_seq);
+	c[5] = fzsync_atomic_load(&pair->a_attempt);
+	c[6] = fzsync_atomic_load(&pair->b_attempt);
+}
+
+/**
+ * Print the wait channel and kernel stack of each task in a directory
+ *
+ * @relates fzsync_pair
+ * @param dir A task directory such as /proc/self/task
+ *
+ * The kernel stack is usually only readable by root.
+ */
+static void fzsync_watchdog_dump(struct fzsync_pair *pair, const char *dir)
+{
+	char path[PATH_MAX], comm[64], wchan[128], line[256];
+	const char *role;
+	struct dirent *d;
+	DIR *tasks = opendir(dir);
+	pid_t tid, self = syscall(SYS_gettid);
+	FILE *f;
+
+	if (!tasks)
+		return;
+
+	while ((d = readdir(tasks))) {
+		tid = atoi(d->d_name);
+		if (tid <= 0 || tid == self)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%d/comm", dir, tid);
+		f = fopen(path, "r");
+		if (!f || !fgets(comm, sizeof(comm), f))
+			strcpy(comm, "?");
+		if (f)
+			fclose(f);
+		comm[strcspn(comm, "\n")] = '\0';
+
+		snprintf(path, sizeof(path), "%s/%d/wchan", dir, tid);
+		f = fopen(path, "r");
+		if (!f || !fgets(wchan, sizeof(wchan), f))
+			strcpy(wchan, "?");
+		if (f)
+			fclose(f);
+
+		role = tid == pair->a_tid ? ", thread A" :
+			tid == pair->wrap_run_b.tid ? ", thread B" : "";
+		fzsync_printf("task %d (%s%s): wchan = %s", tid, comm, role, wchan);
+
+		snprintf(path, sizeof(path), "%s/%d/stack", dir, tid);
+		f = fopen(path, "r");
+		while (f && fgets(line, sizeof(line), f)) {
+			line[strcspn(line, "\n")] = '\0';
+			fzsync_printf("\t%s", line);
+		}
+		if (f)
+			fclose(f);
+	}
+
+	closedir(tasks);
+}
+
+/**
+ * Report a hung iteration
+ *
+ * @relates fzsync_pair
+ *
+ * Each thread increments the other's barrier counter or its own
+ * sequence number when it arrives. So the thread which has arrived
+ * less often is the one which is stuck outside of the barriers.
+ */
+static void fzsync_watchdog_report(struct fzsync_pair *pair, long long ns)
+{
+	char dir[64];
+	int a_ahead, c[FZSYNC_WATCHDOG_COUNTERS];
+	const char *who = "both threads";
+
+	fzsync_watchdog_progress(pair, c);
+	a_ahead = (c[2] - c[1]) + (c[3] - c[4]);
+	if (a_ahead > 0)
+		who = "thread B";
+	else if (a_ahead < 0)
+		who = "thread A";
+
+	fzsync_printf("Watchdog: no progress in loop %d for %lldms, %s appears to be stuck",
+		      c[0], ns / 1000000, who);
+
+	fzsync_watchdog_dump(pair, "/proc/self/task");
+	if (pair->pid_b) {
+		snprintf(dir, sizeof(dir), "/proc/%d/task", pair->pid_b);
+		fzsync_watchdog_dump(pair, dir);
+	}
+}
+
+/**
+ * The body of the watchdog thread
+ *
+ * @relates fzsync_pair
+ *
+ * Wakes every FZSYNC_WATCHDOG_POLL_NS and checks whether any of the
+ * progress counters changed. If they have been still for longer than
+ * watchdog times the longer of the two race windows, or
+ * FZSYNC_WATCHDOG_MIN_NS, the iteration is reported once. The process
+ * is aborted afterwards if watchdog_abort is set. The window is read
+ * from watchdog_window, which fzsync_pair_update() publishes
+ * atomically, rather than from the statistics thread A is updating.
+ */
+static void *fzsync_watchdog_main(void *arg)
+{
+	struct fzsync_pair *pair = arg;
+	struct timespec last, now;
+	struct timespec nap = {
+		FZSYNC_WATCHDOG_POLL_NS / 1000000000,
+		FZSYNC_WATCHDOG_POLL_NS % 1000000000
+	};
+	int seen[FZSYNC_WATCHDOG_COUNTERS], c[FZSYNC_WATCHDOG_COUNTERS];
+	int reported = 0;
+	long long ns, limit;
+
+	fzsync_watchdog_progress(pair, seen);
+	fzsync_time(&last);
+
+	while (!fzsync_atomic_load(&pair->watchdog_stop)) {
+		nanosleep(&nap, NULL);
+		fzsync_time(&now);
+
+		fzsync_watchdog_progress(pair, c);
+		if (memcmp(c, seen, sizeof(c))) {
+			memcpy(seen, c, sizeof(seen));
+			last = now;
+			reported = 0;
+			continue;
+		}
+
+		ns = fzsync_ts_ns(now) - fzsync_ts_ns(last);
+		limit = pair->watchdog
+			* fzsync_atomic_load(&pair->watchdog_window);
+		if (reported || ns < MAX(limit, FZSYNC_WATCHDOG_MIN_NS))
+			continue;
+
+		fzsync_watchdog_report(pair, ns);
+		fzsync_atomic_inc(&pair->watchdog_reports);
+		reported = 1;
+
+		if (pair->watchdog_abort) {
+			fzsync_printf("Watchdog: aborting");
+			abort();
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the watchdog thread if it is enabled
+ *
+ * @relates fzsync_pair
+ * @returns Zero or the result of pthread_create()
+ */
+static int fzsync_watchdog_start(struct fzsync_pair *pair)
+{
+	pair->a_tid = syscall(SYS_gettid);
+	pair->watchdog_stop = 0;
+	pair->watchdog_reports = 0;
+	pair->watchdog_window = 0;
+
+	if (!pair->watchdog)
+		return 0;
+
+	return pthread_create(&pair->watchdog_thread, NULL,
+			      fzsync_watchdog_main, pair);
+}
+
+/**
+ * Stop the watchdog thread if it is running
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_watchdog_stop(struct fzsync_pair *pair)
+{
+	if (!pair->watchdog_thread)
+		return;
+
+	fzsync_atomic_store(1, &pair->watchdog_stop);
+	pthread_join(pair->watchdog_thread, NULL);
+	pair->watchdog_thread = 0;
+}
+
+/**
+ * Stop the controller thread if it is running
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_ctl_main()
+ */
+static void fzsync_ctl_stop(struct fzsync_pair *pair)
+{
+	if (!pair->ctl_thread)
+		return;
+
+	fzsync_atomic_store(1, &pair->ctl_stop);
+	pthread_join(pair->ctl_thread, NULL);
+	pair->ctl_thread = 0;
+}
+
+/**
+ * Exit and join thread B if necessary.
+ *
+ * @relates fzsync_pair
+ * @returns The result of pthread_join() or fzsync_reap_b()
+ *
+ * Call this from your cleanup function. A persistent thread B is only
+ * parked, see fzsync_worker_park().
+ */
+static int fzsync_pair_cleanup(struct fzsync_pair *pair)
+{
+	int rval = 0;
+
+	if (pair->pid_b)
+		rval = fzsync_reap_b(pair);
+
+	if (pair->worker) {
+		rval = fzsync_worker_park(pair);
+	} else if (pair->thread_b) {
+		/* Revoke thread B if parent hits accidental break */
+		if (!pair->exit) {
+			fzsync_atomic_store(1, &pair->exit);
+			if (pair->up || pair->pct)
+				fzsync_up_pass(pair, FZSYNC_UP_EXIT);
+			if (!fzsync_wait_done(&pair->b_done)) {
+				fzsync_printf("Thread B did not exit, cancelling it");
+				pthread_cancel(pair->thread_b);
+			}
+		}
+		rval = pthread_join(pair->thread_b, NULL);
+		pair->thread_b = 0;
+	}
+
+	fzsync_ctl_stop(pair);
+	fzsync_up_restore(pair);
+	fzsync_tm_stop(pair);
+	pair->pct = 0;
+	fzsync_watchdog_stop(pair);
+	fzsync_place_account(pair);
+	fzsync_place_restore(pair);
+	fzsync_sigterm_restore(pair);
+
+	return rval;
+}
+
+/**
+ * Wrap run_b for fzsync_pair_reset to enable pthread cancel
+ * at the start of the thread B.
+ *
+ * Sets done when run_b returns. The wrapper keeps a pointer to
+ * run_thread, so it must outlive the thread. A struct on the caller's
+ * stack is fine if the caller joins thread B, for example with
+ * fzsync_pair_cleanup(), before returning.
+ */
+static void *fzsync_thread_wrapper(void *run_thread)
+{
+	struct fzsync_run_thread *t = run_thread;
+	void *ret;
+
+	t->tid = syscall(SYS_gettid);
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	ret = t->func(t->arg);
+	fzsync_atomic_store(1, &t->done);
+
+	return ret;
+}
+
+/**
+ * The body of thread B when it is started by fzsync_pair_reset()
+ *
+ * Also sets the pair's done flag when run_b returns, in case it broke
+ * out of its loop without seeing the exit request.
+ */
+static void *fzsync_pair_b_main(void *arg)
+{
+	struct fzsync_pair *pair = arg;
+	void *ret = fzsync_thread_wrapper(&pair->wrap_run_b);
+
+	fzsync_atomic_store(1, &pair->b_done);
+
+	return ret;
+}
+
+/**
+ * The body of a persistent thread B
+ *
+ * Runs each run_b handed over by fzsync_pair_reset() and parks in
+ * between. Cancellation is only enabled while run_b is running, so the
+ * worker can't be cancelled while holding worker_lock.
+ */
+static void *fzsync_worker_main(void *arg)
+{
+	struct fzsync_pair *pair = arg;
+	struct fzsync_run_thread t;
+	int run = 0;
+
+	pair->wrap_run_b.tid = syscall(SYS_gettid);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+	pthread_mutex_lock(&pair->worker_lock);
+	for (;;) {
+		while (pair->worker_run == run && !pair->worker_quit) {
+			pthread_cond_wait(&pair->worker_cond,
+					  &pair->worker_lock);
+		}
+
+		if (pair->worker_quit)
+			break;
+
+		run = pair->worker_run;
+		t = pair->wrap_run_b;
+		pthread_mutex_unlock(&pair->worker_lock);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		t.func(t.arg);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		fzsync_atomic_store(1, &pair->b_done);
+
+		pthread_mutex_lock(&pair->worker_lock);
+		pair->worker_done = run;
+		pthread_cond_broadcast(&pair->worker_cond);
+	}
+	pthread_mutex_unlock(&pair->worker_lock);
+
+	return NULL;
+}
+
+/**
+ * Start thread B as a persistent worker or hand it the next run
+ *
+ * @relates fzsync_pair
+ * @returns Zero or the result of pthread_create()
+ */
+static int fzsync_worker_start(struct fzsync_pair *pair)
+{
+	int rval;
+
+	if (pair->worker) {
+		pthread_mutex_lock(&pair->worker_lock);
+		pair->worker_run++;
+		pthread_cond_broadcast(&pair->worker_cond);
+		pthread_mutex_unlock(&pair->worker_lock);
+
+		return 0;
+	}
+
+	pthread_mutex_init(&pair->worker_lock, NULL);
+	pthread_cond_init(&pair->worker_cond, NULL);
+	pair->worker_run = 1;
+	pair->worker_done = 0;
+	pair->worker_quit = 0;
+
+	rval = pthread_create(&pair->thread_b, 0, fzsync_worker_main, pair);
+	if (rval) {
+		pthread_mutex_destroy(&pair->worker_lock);
+		pthread_cond_destroy(&pair->worker_cond);
+		return rval;
+	}
+
+	pair->worker = 1;
+
+	return 0;
+}
+
+/**
+ * Zero some stat fields
+ *
+ * @relates fzsync_stat
+ */
+static void fzsync_init_stat(struct fzsync_stat *s)
+{
+	s->avg = 0;
+	s->avg_dev = 0;
+}
+
+/**
+ * Seed the state for erand48() unless it has already been seeded
+ *
+ * The default seed continues the same sequence as drand48() without
+ * a seed. Setting a different state before the first reset gives an
+ * independent sequence.
+ */
+static inline void fzsync_rand_init(unsigned short state[3])
+{
+	if (state[0] || state[1] || state[2])
+		return;
+
+	state[0] = 0x330E;
+	state[1] = 0xABCD;
+	state[2] = 0x1234;
+}
+
+/**
+ * Approximately return the time remaining in seconds
+ *
+ * If less than a second is remaining we round up to 1
+ */
+static long fzsync_time_remaining(float exec_time, struct timespec start)
+{
+	struct timespec now;
+	long res = exec_time;
+
+	fzsync_time(&now);
+	assert(now.tv_sec >= start.tv_sec);
+	res -= (now.tv_sec - start.tv_sec);
+
+	if (res > 0)
+		return res;
+
+	if (res < 0)
+		return 0;
+
+	res = now.tv_nsec - start.tv_nsec;
+
+	if (res > 0)
+		return 1;
+
+	return 0;
+}
+
+/**
+ * Approximately return the time remaining for a pair in seconds
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_time_remaining
+ */
+static long fzsync_timeout_remaining(const struct fzsync_pair *pair)
+{
+	return fzsync_time_remaining(pair->exec_time, pair->exec_time_start);
+}
+
+/** The maximum length of a line in the timing profile cache */
+#define FZSYNC_PROFILE_LINE 1024
+
+/**
+ * Get pointers to each of the timing statistics in a pair
+ *
+ * @relates fzsync_pair
+ *
+ * Used when (de)serialising a pair or a struct fzsync_region, which
+ * has fields of the same names. The order must not be changed without
+ * invalidating existing profiles.
+ */
+#define FZSYNC_PAIR_STATS(pair) {					\
+		&(pair)->diff_ss, &(pair)->diff_sa, &(pair)->diff_sb,	\
+		&(pair)->diff_ab, &(pair)->spins_avg			\
+	}
+
+/**
+ * Create the key which identifies a timing profile
+ *
+ * @relates fzsync_pair
+ *
+ * The key is the profile name, the CPU model and the kernel release
+ * separated by tabs.
+ */
+static void fzsync_profile_key(const struct fzsync_pair *pair,
+			       char *key, size_t len)
+{
+	char name[64] = "unknown", cpu[256] = "unknown", line[512];
+	const char *val;
+	struct utsname uts;
+	FILE *f;
+
+	if (pair->profile_name) {
+		snprintf(name, sizeof(name), "%s", pair->profile_name);
+	} else if ((f = fopen("/proc/self/comm", "r"))) {
+		if (!fgets(name, sizeof(name), f))
+			strcpy(name, "unknown");
+		name[strcspn(name, "\n")] = '\0';
+		fclose(f);
+	}
+
+	if ((f = fopen("/proc/cpuinfo", "r"))) {
+		while (fgets(line, sizeof(line), f)) {
+			if (strncmp(line, "model name", 10))
+				continue;
+
+			val = strchr(line, ':');
+			if (val)
+				snprintf(cpu, sizeof(cpu), "%s", val + 1 + strspn(val + 1, " "));
+			cpu[strcspn(cpu, "\n")] = '\0';
+			break;
+		}
+		fclose(f);
+	}
+
+	if (uname(&uts))
+		strcpy(uts.release, "unknown");
+
+	snprintf(key, len, "%s\t%s\t%s", name, cpu, uts.release);
+}
+
+/**
+ * Copy the statistics, sampling state and delay bias of a pair to a region
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_region_get(const struct fzsync_pair *pair,
+			      struct fzsync_region *r)
+{
+	r->diff_ss = pair->diff_ss;
+	r->diff_sa = pair->diff_sa;
+	r->diff_sb = pair->diff_sb;
+	r->diff_ab = pair->diff_ab;
+	r->spins_avg = pair->spins_avg;
+	r->sampling = pair->sampling;
+	r->delay_bias = pair->delay_bias;
+}
+
+/**
+ * Copy the statistics, sampling state and delay bias of a region to a pair
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_region_get()
+ */
+static void fzsync_region_set(struct fzsync_pair *pair,
+			      const struct fzsync_region *r)
+{
+	pair->diff_ss = r->diff_ss;
+	pair->diff_sa = r->diff_sa;
+	pair->diff_sb = r->diff_sb;
+	pair->diff_ab = r->diff_ab;
+	pair->spins_avg = r->spins_avg;
+	pair->sampling = r->sampling;
+	pair->delay_bias = r->delay_bias;
+}
+
+/**
+ * Parse the average, average deviation and deviation ratio of a statistic
+ *
+ * @relates fzsync_stat
+ * @returns A pointer to the remaining text or NULL on error
+ */
+static const char *fzsync_stat_parse(struct fzsync_stat *s, const char *text)
+{
+	char *end;
+
+	s->avg = strtof(text, &end);
+	if (end == text)
+		return NULL;
+	s->avg_dev = strtof(text = end, &end);
+	if (end == text)
+		return NULL;
+	s->dev_ratio = strtof(text = end, &end);
+	if (end == text)
+		return NULL;
+
+	return end;
+}
+
+/**
+ * Print a statistic in the format read by fzsync_stat_parse()
+ *
+ * @relates fzsync_stat
+ */
+static void fzsync_stat_write(const struct fzsync_stat *s, FILE *f)
+{
+	fprintf(f, " %.9g %.9g %.9g", s->avg, s->avg_dev, s->dev_ratio);
+}
+
+/**
+ * Parse the values of a timing profile or checkpoint record
+ *
+ * @relates fzsync_region
+ * @returns A pointer to the remaining text or NULL on error
+ *
+ * The statistics of r are only written if they can all be parsed.
+ */
+static const char *fzsync_stats_parse(struct fzsync_region *r,
+				      const char *text)
+{
+	struct fzsync_stat *stats[] = FZSYNC_PAIR_STATS(r);
+	struct fzsync_stat s[sizeof(stats) / sizeof(stats[0])];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+		text = fzsync_stat_parse(s + i, text);
+		if (!text)
+			return NULL;
+	}
+
+	for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+		*stats[i] = s[i];
+
+	return text;
+}
+
+/**
+ * Print the values of a timing profile or checkpoint record
+ *
+ * @relates fzsync_region
+ * @sa fzsync_stats_parse()
+ */
+static void fzsync_stats_write(const struct fzsync_region *r, FILE *f)
+{
+	const struct fzsync_stat *stats[] = FZSYNC_PAIR_STATS(r);
+	unsigned int i;
+
+	for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+		fzsync_stat_write(stats[i], f);
+}
+
+/**
+ * Try to warm-start the statistics from the timing profile cache
+ *
+ * @relates fzsync_pair
+ * @returns One if a matching profile was loaded, otherwise zero
+ *
+ * Each line of the profile cache is a key followed by the averages of
+ * each statistic and the delay bias. A missing or corrupt profile is
+ * not an error, the statistics are just sampled from scratch. The
+ * statistics of the phases and marks are not in the profile, they are
+ * sampled again while the profile is verified.
+ */
+static int fzsync_profile_load(struct fzsync_pair *pair)
+{
+	char key[FZSYNC_PROFILE_LINE], line[FZSYNC_PROFILE_LINE];
+	struct fzsync_region r;
+	const char *vals;
+	size_t klen;
+	int found = 0;
+	FILE *f;
+
+	if (!pair->profile_path)
+		return 0;
+
+	f = fopen(pair->profile_path, "r");
+	if (!f)
+		return 0;
+
+	fzsync_profile_key(pair, key, sizeof(key));
+	klen = strlen(key);
+
+	while (!found && fgets(line, sizeof(line), f)) {
+		if (strncmp(line, key, klen) || line[klen] != '\t')
+			continue;
+
+		vals = fzsync_stats_parse(&r, line + klen + 1);
+		if (vals && sscanf(vals, "%d", &r.delay_bias) == 1)
+			found = 1;
+	}
+	fclose(f);
+
+	if (!found)
+		return 0;
+
+	r.sampling = pair->sampling;
+	fzsync_region_set(pair, &r);
+	fzsync_printf("Loaded timing profile from %s", pair->profile_path);
+
+	return 1;
+}
+
+/**
+ * Write the current statistics to the timing profile cache
+ *
+ * @relates fzsync_pair
+ *
+ * Any existing profile with the same key is replaced. The new cache is
+ * written to a temporary file which is then renamed over the old one.
+ * Only region 0 is saved and nothing is saved while rotating through
+ * placements.
+ */
+static void fzsync_profile_save(struct fzsync_pair *pair)
+{
+	char key[FZSYNC_PROFILE_LINE], line[FZSYNC_PROFILE_LINE];
+	char tmp_path[PATH_MAX];
+	struct fzsync_region r;
+	FILE *old, *f;
+	size_t klen;
+
+	if (!pair->profile_path || pair->region || pair->placement_loops
+	    || pair->up)
+		return;
+
+	fzsync_profile_key(pair, key, sizeof(key));
+	klen = strlen(key);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", pair->profile_path,
+		 (int)getpid());
+
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		fzsync_printf("fopen(%s, w) -> %s", tmp_path, strerror(errno));
+		return;
+	}
+
+	old = fopen(pair->profile_path, "r");
+	while (old && fgets(line, sizeof(line), old)) {
+		if (strncmp(line, key, klen) || line[klen] != '\t')
+			fputs(line, f);
+	}
+	if (old)
+		fclose(old);
+
+	fzsync_region_get(pair, &r);
+	fprintf(f, "%s\t", key);
+	fzsync_stats_write(&r, f);
+	fprintf(f, " %d\n", r.delay_bias);
+
+	if (fclose(f) || rename(tmp_path, pair->profile_path)) {
+		fzsync_printf("Can't write %s -> %s",
+			      pair->profile_path, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+/**
+ * Save the state of the current region and load that of another
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_region_switch(struct fzsync_pair *pair, int region)
+{
+	fzsync_region_get(pair, pair->regions + pair->region);
+	fzsync_region_set(pair, pair->regions + region);
+	pair->region = region;
+}
+
+/** The first word of a checkpoint file and its format version */
+#define FZSYNC_CHECKPOINT_MAGIC "fzsync-checkpoint 4"
+
+/**
+ * Save the accumulated state of the pair to the checkpoint file
+ *
+ * @relates fzsync_pair
+ *
+ * Called by thread A between iterations. The checkpoint is a single
+ * line containing the loop count, sampling state, delay bias, random
+ * number generator state, statistics, outcome counts, the statistics
+ * of each phase and those of the aligned marks. As with the profile
+ * cache, it is written to a temporary file which is then renamed.
+ *
+ * Only the state of region zero is saved, the other regions are
+ * sampled again after resuming.
+ */
+static void fzsync_checkpoint_save(struct fzsync_pair *pair)
+{
+	struct fzsync_region r;
+	char tmp_path[PATH_MAX];
+	FILE *f;
+	int i;
+
+	if (pair->region)
+		r = pair->regions[0];
+	else
+		fzsync_region_get(pair, &r);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", pair->checkpoint_path,
+		 (int)getpid());
+
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		fzsync_printf("fopen(%s, w) -> %s", tmp_path, strerror(errno));
+		return;
+	}
+
+	fprintf(f, FZSYNC_CHECKPOINT_MAGIC " %d %d %d %hu %hu %hu",
+		fzsync_atomic_load(&pair->exec_loop), r.sampling, r.delay_bias,
+		pair->rand_state[0], pair->rand_state[1], pair->rand_state[2]);
+	fzsync_stats_write(&r, f);
+	for (i = 0; i < FZSYNC_MAX_OUTCOMES; i++)
+		fprintf(f, " %ld", fzsync_atomic_load_long(pair->outcomes + i));
+	fprintf(f, " %d", pair->phase_n);
+	for (i = 0; i < pair->phase_n; i++) {
+		fzsync_stat_write(&pair->phases[i].diff_sa, f);
+		fzsync_stat_write(&pair->phases[i].diff_sb, f);
+	}
+	fzsync_stat_write(&pair->diff_ma, f);
+	fzsync_stat_write(&pair->diff_mb, f);
+	fputc('\n', f);
+
+	if (fclose(f) || rename(tmp_path, pair->checkpoint_path)) {
+		fzsync_printf("Can't write %s -> %s",
+			      pair->checkpoint_path, strerror(errno));
+		unlink(tmp_path);
+	}
+
+	fzsync_time(&pair->checkpoint_time);
+}
+
+/**
+ * Try to resume from the checkpoint file
+ *
+ * @relates fzsync_pair
+ * @returns One if the pair was restored, otherwise zero
+ *
+ * The record is parsed into local variables and the checkpointed
+ * fields of the pair are only assigned if all of it is valid.
+ */
+static int fzsync_checkpoint_load(struct fzsync_pair *pair)
+{
+	char line[FZSYNC_PROFILE_LINE];
+	long outcomes[FZSYNC_MAX_OUTCOMES];
+	struct fzsync_stat phase_sa[FZSYNC_MAX_PHASES];
+	struct fzsync_stat phase_sb[FZSYNC_MAX_PHASES];
+	struct fzsync_stat diff_ma, diff_mb;
+	unsigned short rand_state[3];
+	struct fzsync_region r;
+	const char *vals;
+	int i, n, exec_loop, phase_n, found = 0;
+	FILE *f;
+
+	f = fopen(pair->checkpoint_path, "r");
+	if (!f)
+		return 0;
+
+	if (!fgets(line, sizeof(line), f)
+	    || sscanf(line, FZSYNC_CHECKPOINT_MAGIC " %d %d %d %hu %hu %hu%n",
+		      &exec_loop, &r.sampling, &r.delay_bias,
+		      &rand_state[0], &rand_state[1], &rand_state[2], &n) != 6)
+		goto out;
+
+	vals = fzsync_stats_parse(&r, line + n);
+	for (i = 0; vals && i < FZSYNC_MAX_OUTCOMES; i++) {
+		if (sscanf(vals, " %ld%n", &outcomes[i], &n) != 1)
+			goto out;
+		vals += n;
+	}
+
+	if (!vals || sscanf(vals, " %d%n", &phase_n, &n) != 1
+	    || phase_n < 0 || phase_n > FZSYNC_MAX_PHASES)
+		goto out;
+	vals += n;
+	for (i = 0; vals && i < phase_n; i++) {
+		vals = fzsync_stat_parse(phase_sa + i, vals);
+		if (vals)
+			vals = fzsync_stat_parse(phase_sb + i, vals);
+	}
+	if (vals)
+		vals = fzsync_stat_parse(&diff_ma, vals);
+	if (vals)
+		vals = fzsync_stat_parse(&diff_mb, vals);
+	found = !!vals;
+
+out:
+	fclose(f);
+
+	if (!found) {
+		fzsync_printf("Ignoring invalid checkpoint %s",
+			      pair->checkpoint_path);
+		return 0;
+	}
+
+	pair->exec_loop = exec_loop;
+	memcpy(pair->rand_state, rand_state, sizeof(rand_state));
+	memcpy(pair->outcomes, outcomes, sizeof(outcomes));
+	fzsync_region_set(pair, &r);
+	pair->phase_n = phase_n;
+	for (i = 0; i < phase_n; i++) {
+		pair->phases[i].diff_sa = phase_sa[i];
+		pair->phases[i].diff_sb = phase_sb[i];
+	}
+	pair->diff_ma = diff_ma;
+	pair->diff_mb = diff_mb;
+	fzsync_printf("Resumed from checkpoint %s at loop %d",
+		      pair->checkpoint_path, pair->exec_loop);
+
+	return 1;
+}
+
+/**
+ * Write a checkpoint if one is due
+ *
+ * @relates fzsync_pair
+ * @param exit Whether thread A is about to exit
+ */
+static void fzsync_checkpoint_run(struct fzsync_pair *pair, int exit)
+{
+	struct timespec now;
+
+	if (!exit && pair->checkpoint_interval) {
+		fzsync_time(&now);
+		exit = now.tv_sec - pair->checkpoint_time.tv_sec
+			>= pair->checkpoint_interval;
+	}
+
+	if (exit)
+		fzsync_checkpoint_save(pair);
+}
+
+#ifdef CPU_SETSIZE
+/**
+ * Read a CPU list such as "0-3,8" from sysfs
+ *
+ * @returns Zero on success. The set is empty if the file can't be read.
+ */
+static int fzsync_cpulist_read(const char *path, cpu_set_t *set)
+{
+	char buf[1024], *p = buf;
+	int lo, hi, n;
+	FILE *f = fopen(path, "r");
+
+	CPU_ZERO(set);
+	if (!f)
+		return -1;
+
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (!p)
+		return -1;
+
+	while (sscanf(p, "%d%n", &lo, &n) == 1) {
+		p += n;
+		hi = lo;
+		if (*p == '-' && sscanf(p + 1, "%d%n", &hi, &n) == 1)
+			p += n + 1;
+
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+			CPU_SET(lo, set);
+
+		if (*p++ != ',')
+			break;
+	}
+
+	return 0;
+}
+
+/**
+ * Read the CPUs sharing a core and the last level cache with a CPU
+ *
+ * The last level cache is the highest cache level listed for the
+ * CPU. It is left empty if there is no cache information.
+ *
+ * @returns Zero on success
+ */
+static int fzsync_cpu_topo(int cpu, cpu_set_t *core, cpu_set_t *llc)
+{
+	char path[128];
+	int i, level, max = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+		 cpu);
+	if (fzsync_cpulist_read(path, core))
+		return -1;
+
+	CPU_ZERO(llc);
+	for (i = 0; ; i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+			 cpu, i);
+		f = fopen(path, "r");
+		if (!f)
+			break;
+
+		if (fscanf(f, "%d", &level) != 1)
+			level = 0;
+		fclose(f);
+
+		if (level <= max)
+			continue;
+
+		max = level;
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+			 cpu, i);
+		fzsync_cpulist_read(path, llc);
+	}
+
+	return 0;
+}
+
+/**
+ * Whether CPUs a and b satisfy a placement
+ *
+ * @param core The CPUs sharing a core with a
+ * @param llc The CPUs sharing the last level cache with a
+ */
+static int fzsync_place_match(enum fzsync_placement place, int a, int b,
+			      cpu_set_t *core, cpu_set_t *llc)
+{
+	switch (place) {
+	case FZSYNC_PLACE_SAME_CPU:
+		return a == b;
+	case FZSYNC_PLACE_SMT:
+		return a != b && CPU_ISSET(b, core);
+	case FZSYNC_PLACE_LLC:
+		return !CPU_ISSET(b, core) && CPU_ISSET(b, llc);
+	case FZSYNC_PLACE_CROSS_LLC:
+		return CPU_COUNT(llc) && !CPU_ISSET(b, llc);
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Find a pair of CPUs for a placement
+ *
+ * @param quiet Only try isolated and nohz_full CPUs, otherwise only
+ *              try the CPUs the process may run on.
+ * @returns Zero if a pair was found
+ */
+static int fzsync_place_find(enum fzsync_placement place, int quiet,
+			     int *cpu_a, int *cpu_b)
+{
+	cpu_set_t set, nohz, core, llc;
+	int a, b;
+
+	if (quiet) {
+		fzsync_cpulist_read("/sys/devices/system/cpu/isolated", &set);
+		fzsync_cpulist_read("/sys/devices/system/cpu/nohz_full", &nohz);
+		CPU_OR(&set, &set, &nohz);
+	} else if (sched_getaffinity(0, sizeof(set), &set)) {
+		return -1;
+	}
+
+	for (a = 0; a < CPU_SETSIZE; a++) {
+		if (!CPU_ISSET(a, &set))
+			continue;
+
+		/* Needs no topology, which may be hidden, e.g. in containers */
+		if (place == FZSYNC_PLACE_SAME_CPU) {
+			*cpu_a = *cpu_b = a;
+			return 0;
+		}
+
+		if (fzsync_cpu_topo(a, &core, &llc))
+			continue;
+
+		for (b = 0; b < CPU_SETSIZE; b++) {
+			if (CPU_ISSET(b, &set)
+			    && fzsync_place_match(place, a, b, &core, &llc)) {
+				*cpu_a = a;
+				*cpu_b = b;
+				return 0;
+			}
+		}
+	}
+
+	return -1;
+}
+#endif
+
+/** The magic at the start of a latency cache */
+#define FZSYNC_LATENCY_MAGIC "fzsync-latency 1"
+/** The maximum number of CPUs considered by fzsync_latency_fastest() */
+#define FZSYNC_LATENCY_CPUS 1024
+/** The number of barriers in each latency measurement */
+#define FZSYNC_LATENCY_ROUNDS 1000
+/** The number of measurements of each CPU pair, the fastest is kept */
+#define FZSYNC_LATENCY_TRIALS 3
+
+/** The state shared with the second thread of a latency probe */
+struct fzsync_latency_echo {
+	int cpu;
+	int a_cntr;
+	int b_cntr;
+};
+
+/** The second thread of a latency probe */
+static void *fzsync_latency_echo(void *arg)
+{
+	struct fzsync_latency_echo *e = arg;
+	int i;
+
+	fzsync_pin(pthread_self(), e->cpu);
+	for (i = 0; i < FZSYNC_LATENCY_TRIALS * (FZSYNC_LATENCY_ROUNDS + 1); i++)
+		fzsync_pair_wait(&e->b_cntr, &e->a_cntr, NULL);
+
+	return NULL;
+}
+
+/**
+ * Measure the time fzsync_pair_wait() takes between two CPUs
+ *
+ * The calling thread is pinned to cpu_a and a second thread is started
+ * on cpu_b. Both pass through FZSYNC_LATENCY_ROUNDS barriers. Each
+ * barrier moves the counters' cache line from one CPU to the other and
+ * back, so this bounds how precisely the threads can be aligned. The
+ * calling thread's affinity is restored afterwards.
+ *
+ * @returns The fastest average time per barrier in ns or -1 on error
+ */
+static float fzsync_latency_probe(int cpu_a, int cpu_b)
+{
+	struct fzsync_latency_echo echo = { .cpu = cpu_b };
+	struct timespec start, end;
+	pthread_t thread;
+	float ns, best = -1;
+	int i, j;
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+		return -1;
+#endif
+
+	if (fzsync_pin(pthread_self(), cpu_a)
+	    || pthread_create(&thread, NULL, fzsync_latency_echo, &echo))
+		goto out;
+
+	for (i = 0; i < FZSYNC_LATENCY_TRIALS; i++) {
+		fzsync_pair_wait(&echo.a_cntr, &echo.b_cntr, NULL);
+		fzsync_time(&start);
+		for (j = 0; j < FZSYNC_LATENCY_ROUNDS; j++)
+			fzsync_pair_wait(&echo.a_cntr, &echo.b_cntr, NULL);
+		fzsync_time(&end);
+
+		ns = fzsync_diff_ns(end, start) / (float)FZSYNC_LATENCY_ROUNDS;
+		if (best < 0 || ns < best)
+			best = ns;
+	}
+
+	pthread_join(thread, NULL);
+out:
+#ifdef CPU_SETSIZE
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	return best;
+}
+
+/**
+ * Create the first line of a latency cache
+ *
+ * Latencies are only valid for the machine and kernel that measured
+ * them, so the host name and kernel release follow the magic.
+ */
+static void fzsync_latency_key(char *key, size_t len)
+{
+	struct utsname uts;
+
+	if (uname(&uts)) {
+		strcpy(uts.nodename, "unknown");
+		strcpy(uts.release, "unknown");
+	}
+
+	snprintf(key, len, "%s\t%s\t%s\n",
+		 FZSYNC_LATENCY_MAGIC, uts.nodename, uts.release);
+}
+
+/**
+ * Load the cached latencies between the given CPUs
+ *
+ * @param idx Maps a CPU number to its row and column in lat or -1
+ * @returns Zero if the cache belongs to this machine
+ */
+static int fzsync_latency_load(const char *path, const int *idx, int n,
+			       float *lat)
+{
+	char key[FZSYNC_PROFILE_LINE], line[FZSYNC_PROFILE_LINE];
+	int a, b, rval = -1;
+	float ns;
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return -1;
+
+	fzsync_latency_key(key, sizeof(key));
+	if (!fgets(line, sizeof(line), f) || strcmp(line, key))
+		goto out;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%d %d %f", &a, &b, &ns) != 3
+		    || a < 0 || a >= FZSYNC_LATENCY_CPUS
+		    || b < 0 || b >= FZSYNC_LATENCY_CPUS
+		    || idx[a] < 0 || idx[b] < 0 || ns < 0)
+			continue;
+
+		lat[idx[a] * n + idx[b]] = ns;
+	}
+	rval = 0;
+out:
+	fclose(f);
+
+	return rval;
+}
+
+/**
+ * Find the pair of different CPUs with the lowest latency
+ *
+ * @param path Optional latency cache
+ * @returns Zero if a pair was found
+ *
+ * Every pair of CPUs the process may run on is measured with
+ * fzsync_latency_probe() unless its latency is in the cache. New
+ * measurements are appended to the cache, which is started again if it
+ * came from another machine or kernel. This takes a few seconds on
+ * large machines, so setting a cache is recommended.
+ */
+static int fzsync_latency_fastest(const char *path, int *cpu_a, int *cpu_b)
+{
+	int cpus[FZSYNC_LATENCY_CPUS], idx[FZSYNC_LATENCY_CPUS];
+	int i, j, n, cached = -1;
+	char key[FZSYNC_PROFILE_LINE];
+	float *lat, best = -1;
+	FILE *f = NULL;
+
+	n = fzsync_cpus(cpus, FZSYNC_LATENCY_CPUS);
+	lat = malloc(sizeof(*lat) * n * n);
+	if (!lat)
+		return -1;
+
+	for (i = 0; i < FZSYNC_LATENCY_CPUS; i++)
+		idx[i] = -1;
+	for (i = 0; i < n; i++)
+		idx[cpus[i]] = i;
+	for (i = 0; i < n * n; i++)
+		lat[i] = -1;
+
+	if (path)
+		cached = fzsync_latency_load(path, idx, n, lat);
+
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			if (lat[i * n + j] < 0) {
+				lat[i * n + j] = fzsync_latency_probe(cpus[i], cpus[j]);
+
+				if (path && !f) {
+					f = fopen(path, cached ? "w" : "a");
+					fzsync_latency_key(key, sizeof(key));
+					if (f && cached)
+						fputs(key, f);
+				}
+				if (f && lat[i * n + j] >= 0) {
+					fprintf(f, "%d %d %.1f\n", cpus[i], cpus[j],
+						lat[i * n + j]);
+				}
+			}
+
+			if (lat[i * n + j] < 0
+			    || (best >= 0 && lat[i * n + j] >= best))
+				continue;
+
+			best = lat[i * n + j];
+			*cpu_a = cpus[i];
+			*cpu_b = cpus[j];
+		}
+	}
+
+	if (f)
+		fclose(f);
+	free(lat);
+
+	if (best < 0)
+		return -1;
+
+	fzsync_printf("Fastest CPU pair is %d and %d at %.0fns per barrier",
+		      *cpu_a, *cpu_b, best);
+
+	return 0;
+}
+
+/**
+ * Find the fastest pair of CPUs if it may be needed
+ *
+ * @relates fzsync_pair
+ *
+ * Called on reset, before thread B exists, when the placement is
+ * FZSYNC_PLACE_FASTEST or placements are rotated. So the probes never
+ * run while thread B is spinning in the middle of a run. The pair found
+ * is kept by the fzsync_pair, so later resets neither probe again nor
+ * read the latency cache.
+ */
+static void fzsync_place_probe(struct fzsync_pair *pair)
+{
+#ifdef CPU_SETSIZE
+	if (pair->fastest_a < 0
+	    && (pair->placement == FZSYNC_PLACE_FASTEST || pair->placement_loops)) {
+		fzsync_latency_fastest(pair->latency_path,
+				       &pair->fastest_a, &pair->fastest_b);
+	}
+#endif
+}
+
+/**
+ * Pin threads A and B according to a placement
+ *
+ * @relates fzsync_pair
+ * @returns Zero if the threads were placed
+ *
+ * Does nothing but restore thread A's affinity for FZSYNC_PLACE_ANY.
+ * The topology is read from /sys. Isolated and nohz_full CPUs are tried
+ * first, these are usually outside of the process's affinity, then the
+ * CPUs the process may run on. FZSYNC_PLACE_FASTEST only considers the
+ * latter and uses the pair found by fzsync_place_probe(). If thread B
+ * was not started by fzsync_pair_reset(), only thread A is pinned and
+ * the caller should pin thread B to pair->cpu_b.
+ */
+static int fzsync_place(struct fzsync_pair *pair, enum fzsync_placement place)
+{
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+	int quiet, a, b;
+#endif
+
+	fzsync_place_restore(pair);
+	pair->place = place;
+
+	if (place == FZSYNC_PLACE_ANY)
+		return 0;
+
+#ifdef CPU_SETSIZE
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+		return -1;
+
+	memcpy(pair->a_affinity, &set,
+	       MIN(sizeof(set), sizeof(pair->a_affinity)));
+	pair->a_placed = 1;
+
+	for (quiet = 1; quiet >= 0; quiet--) {
+		if (place == FZSYNC_PLACE_FASTEST) {
+			if (quiet || pair->fastest_a < 0)
+				continue;
+			a = pair->fastest_a;
+			b = pair->fastest_b;
+		} else if (fzsync_place_find(place, quiet, &a, &b)) {
+			continue;
+		}
+
+		if (fzsync_pin(pthread_self(), a)
+		    || fzsync_pin_b(pair, b))
+			continue;
+
+		pair->cpu_a = a;
+		pair->cpu_b = b;
+		fzsync_printf("Placed A on CPU %d and B on CPU %d (%s)",
+			      a, b, fzsync_placement_name(place));
+		return 0;
+	}
+#endif
+
+	fzsync_place_restore(pair);
+
+	return -1;
+}
+
+#ifdef CLONE_VM
+/**
+ * The entry point of thread B's process
+ *
+ * Thread B is killed if thread A's process dies, it would otherwise
+ * spin forever waiting for it.
+ */
+static int fzsync_clone_main(void *arg)
+{
+	struct fzsync_pair *pair = arg;
+
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	pair->wrap_run_b.tid = getpid();
+	pair->wrap_run_b.func(pair->wrap_run_b.arg);
+	fzsync_atomic_store(1, &pair->b_done);
+
+	return 0;
+}
+#endif
+
+/**
+ * Start thread B as a process
+ *
+ * @relates fzsync_pair
+ * @returns Zero or an error number
+ *
+ * The process is created with clone(2) using clone_flags and SIGCHLD,
+ * so it can be waited for like a forked child. It runs on its own
+ * stack even without CLONE_VM. The barriers work as they do between
+ * threads because the counters are in the shared pair.
+ *
+ * With CLONE_VM, thread B shares thread A's thread local storage
+ * including errno. It is best to only make system calls in it.
+ */
+static int fzsync_clone_b(struct fzsync_pair *pair)
+{
+#ifdef CLONE_VM
+	char *stack;
+	int rval;
+
+	assert(pair->shared || (pair->clone_flags & CLONE_VM));
+	assert(!(pair->clone_flags & (CLONE_THREAD | CSIGNAL)));
+
+	stack = mmap(NULL, FZSYNC_CLONE_STACK, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED)
+		return errno;
+
+	pair->pid_b = clone(fzsync_clone_main, stack + FZSYNC_CLONE_STACK,
+			    pair->clone_flags | SIGCHLD, pair);
+	if (pair->pid_b < 0) {
+		rval = errno;
+		munmap(stack, FZSYNC_CLONE_STACK);
+		pair->pid_b = 0;
+		return rval;
+	}
+
+	pair->stack_b = stack;
+
+	return 0;
+#else
+	(void)pair;
+
+	return ENOSYS;
+#endif
+}
+
+/**
+ * Allocate a pair which can be shared with thread B's process
+ *
+ * @relates fzsync_pair
+ * @returns A zeroed pair in a MAP_SHARED mapping or NULL
+ *
+ * Use this with clone_b when thread B does not share thread A's memory.
+ * Initialise the pair with fzsync_pair_init() as usual and free it with
+ * fzsync_pair_munmap() after fzsync_pair_cleanup().
+ */
+static inline struct fzsync_pair *fzsync_pair_mmap(void)
+{
+	struct fzsync_pair *pair;
+
+	pair = mmap(NULL, sizeof(*pair), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (pair == MAP_FAILED)
+		return NULL;
+
+	pair->shared = 1;
+
+	return pair;
+}
+
+/**
+ * Free a pair allocated by fzsync_pair_mmap()
+ *
+ * @relates fzsync_pair
+ */
+static inline void fzsync_pair_munmap(struct fzsync_pair *pair)
+{
+	munmap(pair, sizeof(*pair));
+}
+
+/**
+ * Discard the timings so that they are sampled again
+ *
+ * @relates fzsync_pair
+ *
+ * Resets the statistics and sampling state of the current and saved
+ * regions, the marks and the phases, so none of them are left with
+ * timings from before.
+ */
+static void fzsync_pair_reset_stats(struct fzsync_pair *pair)
+{
+	int i;
+
+	fzsync_init_stat(&pair->diff_ss);
+	fzsync_init_stat(&pair->diff_sa);
+	fzsync_init_stat(&pair->diff_sb);
+	fzsync_init_stat(&pair->diff_ab);
+	fzsync_init_stat(&pair->spins_avg);
+	pair->delay = 0;
+	pair->sampling = pair->min_samples;
+
+	for (i = 0; i < FZSYNC_MAX_REGIONS; i++) {
+		if (i == pair->region)
+			continue;
+
+		fzsync_init_stat(&pair->regions[i].diff_ss);
+		fzsync_init_stat(&pair->regions[i].diff_sa);
+		fzsync_init_stat(&pair->regions[i].diff_sb);
+		fzsync_init_stat(&pair->regions[i].diff_ab);
+		fzsync_init_stat(&pair->regions[i].spins_avg);
+		pair->regions[i].sampling = pair->min_samples;
+	}
+
+	fzsync_init_stat(&pair->diff_ma);
+	fzsync_init_stat(&pair->diff_mb);
+	for (i = 0; i < FZSYNC_MAX_PHASES; i++) {
+		fzsync_init_stat(&pair->phases[i].diff_sa);
+		fzsync_init_stat(&pair->phases[i].diff_sb);
+		pair->phases[i].delay = 0;
+	}
+}
+
+/**
+ * Reset or initialise fzsync.
+ *
+ * @relates fzsync_pair
+ * @param pair The state structure initialised with FZSYNC_PAIR_INIT.
+ * @param run_b The function defining thread B or NULL.
+ * @param arg The argument passed to run_b.
+ * @returns The result of pthread_create, clock_gettime or zero
+ *
+ * Call this from your main test function (thread A), just before entering the
+ * main loop. It will (re)set any variables needed by fzsync and (re)start
+ * thread B using the function provided.
+ *
+ * If thread B needs to be a process, set clone_b and clone_flags and
+ * allocate the pair with fzsync_pair_mmap() unless CLONE_VM is used.
+ * Otherwise you can pass NULL to run_b and handle starting and stopping
+ * thread B yourself.
+ *
+ * @sa fzsync_pair_init(), fzsync_pair_reset()
+ */
+static inline int fzsync_pair_reset_arg(struct fzsync_pair *pair,
+					void *(*run_b)(void *), void *arg)
+{
+	int i, rval = 0;
+
+	fzsync_pair_cleanup(pair);
+
+	pair->region = 0;
+	pair->region_next = 0;
+	fzsync_pair_reset_stats(pair);
+	for (i = 1; i < FZSYNC_MAX_REGIONS; i++)
+		pair->regions[i].delay_bias = 0;
+	pair->phase_n = 0;
+
+	pair->profile_loaded = fzsync_profile_load(pair);
+	if (pair->profile_loaded)
+		pair->sampling = pair->profile_samples;
+
+	pair->exec_loop = 0;
+	memset(pair->outcomes, 0, sizeof(pair->outcomes));
+	pair->cs = 0;
+
+	fzsync_rand_init(pair->rand_state);
+
+	if (pair->checkpoint_path) {
+		fzsync_sigterm = 0;
+		fzsync_checkpoint_load(pair);
+		fzsync_sigterm_setup(pair);
+	}
+
+	pair->a_cntr = 0;
+	pair->b_cntr = 0;
+	pair->exit = 0;
+	pair->b_done = 0;
+	pair->a_looping = 0;
+	pair->b_looping = 0;
+	pair->batch_len = 0;
+	pair->a_attempt = -1;
+	pair->b_attempt = -1;
+	pair->tt = 0;
+	pair->tt_period = 0;
+	pair->ctl_seq = 0;
+	pair->ctl_lost = 0;
+	pair->up_turn = FZSYNC_UP_A;
+	pair->tm_fired = 0;
+	fzsync_init_stat(&pair->tm_latency);
+	pair->pct_step = 0;
+	pair->pct_steps = 0;
+	pair->arrivals = 0;
+	pair->a_seq = 0;
+	pair->b_seq = 0;
+
+	/* Placed before thread B exists so it can't disturb any probes */
+	fzsync_place_probe(pair);
+	pair->place_loop = pair->exec_loop;
+	pair->place_hit = pair->outcomes[FZSYNC_HIT];
+	memset(pair->place_loops, 0, sizeof(pair->place_loops));
+	memset(pair->place_hits, 0, sizeof(pair->place_hits));
+	if (fzsync_place(pair, pair->placement)) {
+		fzsync_printf("No CPUs for placement %s, leaving it to the scheduler",
+			      fzsync_placement_name(pair->placement));
+	}
+
+	if (run_b) {
+		pair->wrap_run_b.func = run_b;
+		pair->wrap_run_b.arg = arg;
+		pair->wrap_run_b.done = 0;
+		if (pair->clone_b) {
+			rval = fzsync_clone_b(pair);
+		} else if (pair->persistent) {
+			rval = fzsync_worker_start(pair);
+		} else {
+			rval = pthread_create(&pair->thread_b, 0,
+					      fzsync_pair_b_main, pair);
+		}
+
+		if (rval)
+			return rval;
+
+		fzsync_pin_b(pair, pair->cpu_b);
+	}
+
+	rval = fzsync_watchdog_start(pair);
+	if (rval)
+		return rval;
+
+	rval = fzsync_time(&pair->exec_time_start);
+	pair->checkpoint_time = pair->exec_time_start;
+
+	return rval;
+}
+
+/**
+ * Reset or initialise fzsync and start thread B without an argument
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pair_reset_arg()
+ */
+static inline int fzsync_pair_reset(struct fzsync_pair *pair,
+				    void *(*run_b)(void *))
+{
+	return fzsync_pair_reset_arg(pair, run_b, NULL);
+}
+
+/**
+ * Print stat
+ *
+ * @relates fzsync_stat
+ */
+static inline void fzsync_stat_info(struct fzsync_stat stat,
+				    char *unit, char *name)
+{
+	fzsync_printf("%1$-17s: { avg = %3$5.0f%2$s, avg_dev = %4$5.0f%2$s, dev_ratio = %5$.2f }",
+		name, unit, stat.avg, stat.avg_dev, stat.dev_ratio);
+}
+
+/**
+ * Print some synchronisation statistics
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_pair_info(struct fzsync_pair *pair)
+{
+	char name[32];
+	double bound;
+	int i;
+
+	fzsync_printf("loop = %d, region = %d, delay_bias = %d, hits = %ld",
+		      fzsync_atomic_load(&pair->exec_loop), pair->region,
+		      pair->delay_bias,
+		      fzsync_atomic_load_long(pair->outcomes + FZSYNC_HIT));
+	if (pair->cs) {
+		fzsync_printf("critical sections: before = %ld, overlap = %ld, after = %ld",
+			      fzsync_atomic_load_long(pair->outcomes + FZSYNC_BEFORE),
+			      fzsync_atomic_load_long(pair->outcomes + FZSYNC_OVERLAP),
+			      fzsync_atomic_load_long(pair->outcomes + FZSYNC_AFTER));
+	}
+	fzsync_stat_info(pair->diff_ss, "ns", "start_a - start_b");
+	fzsync_stat_info(pair->diff_sa, "ns", "end_a - start_a");
+	fzsync_stat_info(pair->diff_sb, "ns", "end_b - start_b");
+	fzsync_stat_info(pair->diff_ab, "ns", "end_a - end_b");
+	fzsync_stat_info(pair->spins_avg, "  ", "spins");
+
+	if (pair->align) {
+		snprintf(name, sizeof(name), "mark_a%d - start_a", pair->align_a);
+		fzsync_stat_info(pair->diff_ma, "ns", name);
+		snprintf(name, sizeof(name), "mark_b%d - start_b", pair->align_b);
+		fzsync_stat_info(pair->diff_mb, "ns", name);
+	}
+
+	if (pair->ctl_seq) {
+		fzsync_printf("controller: last loop read = %d, lost = %d",
+			      pair->ctl_seq, pair->ctl_lost);
+	}
+	if (pair->pct_steps) {
+		bound = 0.5;
+		for (i = 1; i < pair->pct_depth; i++)
+			bound /= pair->pct_steps;
+
+		fzsync_printf("PCT: depth = %d, steps = %d, bound = %.2e",
+			      pair->pct_depth, pair->pct_steps, bound);
+	}
+	if (pair->tm_latency.avg || pair->tm_latency.avg_dev)
+		fzsync_stat_info(pair->tm_latency, "ns", "timer latency");
+
+	if (pair->placement_loops)
+		fzsync_place_account(pair);
+	for (i = 0; i < FZSYNC_PLACE_MAX && pair->placement_loops; i++) {
+		if (!pair->place_loops[i])
+			continue;
+
+		fzsync_printf("placement %-12s: loops = %ld, hits = %ld, hit rate = %.2e",
+			      fzsync_placement_name(i), pair->place_loops[i],
+			      pair->place_hits[i],
+			      (float)pair->place_hits[i] / pair->place_loops[i]);
+	}
+
+	for (i = 0; i < pair->phase_n; i++) {
+		snprintf(name, sizeof(name), "phase %d a", i);
+		fzsync_stat_info(pair->phases[i].diff_sa, "ns", name);
+		snprintf(name, sizeof(name), "phase %d b", i);
+		fzsync_stat_info(pair->phases[i].diff_sb, "ns", name);
+	}
+}
+
+/**
+ * Exponential moving average
+ *
+ * @param alpha The preference for recent samples over old ones.
+ * @param sample The current sample
+ * @param prev_avg The average of the all the previous samples
+ *
+ * @return The average including the current sample.
+ */
+static inline float fzsync_exp_moving_avg(float alpha,
+					  float sample,
+					  float prev_avg)
+{
+	return alpha * sample + (1.0 - alpha) * prev_avg;
+}
+
+/**
+ * Update a stat with a new sample
+ *
+ * @relates fzsync_stat
+ */
+static inline void fzsync_upd_stat(struct fzsync_stat *s,
+				   float alpha,
+				   float sample)
+{
+	s->avg = fzsync_exp_moving_avg(alpha, sample, s->avg);
+	s->avg_dev = fzsync_exp_moving_avg(alpha,
+					fabs(s->avg - sample), s->avg_dev);
+	s->dev_ratio = fabs(s->avg ? s->avg_dev / s->avg : 0);
+}
+
+/**
+ * Update a stat with a new diff sample
+ *
+ * @relates fzsync_stat
+ */
+static inline void fzsync_upd_diff_stat(struct fzsync_stat *s,
+					float alpha,
+					struct timespec t1,
+					struct timespec t2)
+{
+	fzsync_upd_stat(s, alpha, fzsync_diff_ns(t1, t2));
+}
+
+/**
+ * Check if any of the statistics vary too much to calculate a delay
+ *
+ * @relates fzsync_pair
+ */
+static inline int fzsync_pair_over_max_dev(const struct fzsync_pair *pair)
+{
+	float max_dev = pair->max_dev_ratio;
+
+	return pair->diff_ss.dev_ratio > max_dev
+		|| pair->diff_sa.dev_ratio > max_dev
+		|| pair->diff_sb.dev_ratio > max_dev
+		|| pair->diff_ab.dev_ratio > max_dev
+		|| pair->spins_avg.dev_ratio > max_dev
+		|| (pair->align && (pair->diff_ma.dev_ratio > max_dev
+				    || pair->diff_mb.dev_ratio > max_dev));
+}
+
+/**
+ * Add the timings of one iteration to the statistics
+ *
+ * @relates fzsync_pair
+ *
+ * Also counts down the mandatory sampling period.
+ */
+static void fzsync_pair_sample(struct fzsync_pair *pair,
+			       struct timespec a_start, struct timespec b_start,
+			       struct timespec a_end, struct timespec b_end)
+{
+	float alpha = pair->avg_alpha;
+
+	fzsync_upd_diff_stat(&pair->diff_ss, alpha, a_start, b_start);
+	fzsync_upd_diff_stat(&pair->diff_sa, alpha, a_end, a_start);
+	fzsync_upd_diff_stat(&pair->diff_sb, alpha, b_end, b_start);
+	fzsync_upd_diff_stat(&pair->diff_ab, alpha, a_end, b_end);
+
+	if (pair->sampling > 0 && --pair->sampling == 0) {
+		fzsync_printf("Minimum sampling period ended");
+		fzsync_pair_info(pair);
+	}
+}
+
+/**
+ * The radical inverse of i in the given base
+ *
+ * Consecutive values of i give a low discrepancy sequence in [0, 1).
+ */
+static inline float fzsync_halton(unsigned int i, unsigned int base)
+{
+	float f = 1, r = 0;
+
+	while (i) {
+		f /= base;
+		r += f * (i % base);
+		i /= base;
+	}
+
+	return r;
+}
+
+/**
+ * Pick a random time offset from the delay range
+ *
+ * @relates fzsync_pair
+ *
+ * @return The offset in nanoseconds. A negative value should delay
+ * thread A and a positive one thread B.
+ * @sa fzsync_pair_update
+ */
+static inline float fzsync_pair_rand_time(struct fzsync_pair *pair)
+{
+	float u = pair->phase_n ? fzsync_halton(pair->exec_loop, 2)
+		: erand48(pair->rand_state);
+	float time_delay = u * (pair->diff_sa.avg + pair->diff_sb.avg)
+		- pair->diff_sb.avg;
+
+	return 1.1 * time_delay;
+}
+
+/**
+ * Pick a random time offset close to the alignment target
+ *
+ * @relates fzsync_pair
+ *
+ * The target is the delay which makes mark align_a in thread A happen
+ * at the same time as mark align_b in thread B. The spread is twice the
+ * sum of the average deviations of the start difference and of both
+ * marks.
+ *
+ * @return The offset in nanoseconds
+ * @sa fzsync_pair_align
+ */
+static inline float fzsync_pair_align_time(struct fzsync_pair *pair)
+{
+	float target = pair->diff_ss.avg + pair->diff_ma.avg - pair->diff_mb.avg;
+	float spread = 2 * (pair->diff_ss.avg_dev + pair->diff_ma.avg_dev
+			    + pair->diff_mb.avg_dev);
+
+	return target + (2 * erand48(pair->rand_state) - 1) * spread;
+}
+
+/**
+ * Add the timings of each phase in the last race to their statistics
+ *
+ * @relates fzsync_pair
+ *
+ * Each phase lasts until the next phase's sync point or the end of the
+ * race.
+ */
+static void fzsync_phase_sample(struct fzsync_pair *pair)
+{
+	struct fzsync_phase *p, *next;
+	struct timespec a_end, b_end;
+	int i;
+
+	for (i = 0; i < pair->phase_n; i++) {
+		p = pair->phases + i;
+		next = p + 1;
+		a_end = i + 1 < pair->phase_n ? next->a_arrive : pair->a_end;
+		b_end = i + 1 < pair->phase_n ? next->b_arrive : pair->b_end;
+
+		fzsync_upd_diff_stat(&p->diff_sa, pair->avg_alpha,
+				     a_end, p->a_start);
+		fzsync_upd_diff_stat(&p->diff_sb, pair->avg_alpha,
+				     b_end, p->b_start);
+	}
+}
+
+/**
+ * Pick the delay of each phase for the next race
+ *
+ * @relates fzsync_pair
+ *
+ * The delays of the start of the race and of each phase form a point in
+ * a multidimensional space. Independent random delays would cluster
+ * and leave gaps in that space, so each dimension instead takes the
+ * next value of a Halton sequence with a different prime base. The
+ * sequence is indexed by the loop number, so it also continues after
+ * resuming from a checkpoint.
+ */
+static void fzsync_phase_delays(struct fzsync_pair *pair, float per_spin_time)
+{
+	static const unsigned int bases[FZSYNC_MAX_PHASES] = { 3, 5, 7, 11 };
+	struct fzsync_phase *p;
+	float time_delay;
+	int i;
+
+	for (i = 0; i < pair->phase_n; i++) {
+		p = pair->phases + i;
+		time_delay = fzsync_halton(pair->exec_loop, bases[i])
+			* (p->diff_sa.avg + p->diff_sb.avg) - p->diff_sb.avg;
+		p->delay = (int)(1.1 * time_delay / per_spin_time);
+	}
+}
+
+/**
+ * Calculate various statistics and the delay
+ *
+ * This function helps create the fuzz in fuzzy sync. Imagine we have the
+ * following timelines in threads A and B:
+ *
+ *  start_race_a
+ *      ^                    end_race_a (a)
+ *      |                        ^
+ *      |                        |
+ *  - --+------------------------+-- - -
+ *      |        Syscall A       |                 Thread A
+ *  - --+------------------------+-- - -
+ *  - --+----------------+-------+-- - -
+ *      |   Syscall B    | spin  |                 Thread B
+ *  - --+----------------+-------+-- - -
+ *      |                |
+ *      ^                ^
+ *  start_race_b     end_race_b
+ *
+ * Here we have synchronised the calls to syscall A and B with start_race_{a,
+ * b} so that they happen at approximately the same time in threads A and
+ * B. If the race condition occurs during the entry code for these two
+ * functions then we will quickly hit it. If it occurs during the exit code of
+ * B and mid way through A, then we will quickly hit it.
+ *
+ * However if the exit paths of A and B need to be aligned and (end_race_a -
+ * end_race_b) is large relative to the variation in call times, the
+ * probability of hitting the race condition is close to zero. To solve this
+ * scenario (and others) a randomised delay is introduced before the syscalls
+ * in A and B. Given enough time the following should happen where the exit
+ * paths are now synchronised:
+ *
+ *  start_race_a
+ *      ^                    end_race_a (a)
+ *      |                        ^
+ *      |                        |
+ *  - --+------------------------+-- - -
+ *      |        Syscall A       |                 Thread A
+ *  - --+------------------------+-- - -
+ *  - --+-------+----------------+-- - -
+ *      | delay |   Syscall B    |                 Thread B
+ *  - --+-------+----------------+-- - -
+ *      |                        |
+ *      ^                        ^
+ *  start_race_b             end_race_b
+ *
+ * The delay is not introduced immediately and the delay range is only
+ * calculated once the average relative deviation has dropped below some
+ * percentage of the total time.
+ *
+ * The delay range is chosen so that any point in Syscall A could be
+ * synchronised with any point in Syscall B using a value from the
+ * range. Because the delay range may be too large for a linear search, we use
+ * an evenly distributed random function to pick a value from it.
+ *
+ * The delay range goes from positive to negative. A negative delay will delay
+ * thread A and a positive one will delay thread B. The range is bounded by
+ * the point where the entry code to Syscall A is synchronised with the exit
+ * to Syscall B and the entry code to Syscall B is synchronised with the exit
+ * of A.
+ *
+ * In order to calculate the lower bound (the max delay of A) we can simply
+ * negate the execution time of Syscall B and convert it to a spin count. For
+ * the upper bound (the max delay of B), we just take the execution time of A
+ * and convert it to a spin count.
+ *
+ * In order to calculate spin count we need to know approximately how long a
+ * spin takes and divide the delay time with it. We find this by first
+ * counting how many spins one thread spends waiting for the other during
+ * end_race[1]. We also know when each syscall exits so we can take the
+ * difference between the exit times and divide it with the number of spins
+ * spent waiting.
+ *
+ * All the times and counts we use in the calculation are averaged over a
+ * variable number of iterations. There is an initial sampling period where we
+ * simply collect time and count samples then calculate their averages. When a
+ * minimum number of samples have been collected, and if the average deviation
+ * is below some proportion of the average sample magnitude, then the sampling
+ * period is ended. On all further iterations a random delay is calculated and
+ * applied, but the averages are not updated.
+ *
+ * [1] This assumes there is always a significant difference. The algorithm
+ * may fail to introduce a delay (when one is needed) in situations where
+ * Syscall A and B finish at approximately the same time.
+ *
+ * @relates fzsync_pair
+ */
+static void fzsync_pair_update(struct fzsync_pair *pair)
+{
+	int i, sample = pair->sampling > 0 || fzsync_pair_over_max_dev(pair);
+	float per_spin_time;
+
+	if (sample) {
+		fzsync_upd_stat(&pair->spins_avg, pair->avg_alpha, pair->spins);
+		fzsync_pair_sample(pair, pair->a_start, pair->b_start,
+				   pair->a_end, pair->b_end);
+		fzsync_phase_sample(pair);
+	}
+
+	if (sample && pair->align) {
+		fzsync_upd_diff_stat(&pair->diff_ma, pair->avg_alpha,
+				     pair->a_marks[pair->align_a], pair->a_start);
+		fzsync_upd_diff_stat(&pair->diff_mb, pair->avg_alpha,
+				     pair->b_marks[pair->align_b], pair->b_start);
+	}
+
+	if (pair->region_next != pair->region) {
+		fzsync_region_switch(pair, pair->region_next);
+		sample = pair->sampling > 0 || fzsync_pair_over_max_dev(pair);
+	}
+
+	if (pair->up) {
+		per_spin_time = pair->up_spin_ns;
+	} else {
+		per_spin_time = fabsf(pair->diff_ab.avg)
+			/ MAX(pair->spins_avg.avg, 1.0f);
+	}
+	pair->delay = pair->delay_bias;
+
+	if (sample) {
+		for (i = 0; i < pair->phase_n; i++)
+			pair->phases[i].delay = 0;
+	} else if (fabsf(pair->diff_ab.avg) >= 1) {
+		if (pair->align)
+			pair->delay += (int)(fzsync_pair_align_time(pair) / per_spin_time);
+		else
+			pair->delay += (int)(fzsync_pair_rand_time(pair) / per_spin_time);
+		fzsync_phase_delays(pair, per_spin_time);
+
+		if (!pair->sampling) {
+			fzsync_printf("Reached deviation ratios < %.2f, introducing randomness",
+				      pair->max_dev_ratio);
+			if (pair->align) {
+				fzsync_printf("Aligning mark %d in A with mark %d in B at %.0fns",
+					      pair->align_a, pair->align_b,
+					      pair->diff_ss.avg + pair->diff_ma.avg
+					      - pair->diff_mb.avg);
+			} else {
+				fzsync_printf("Delay range is [%d, %d]",
+					      -(int)(pair->diff_sb.avg / per_spin_time) + pair->delay_bias,
+					      (int)(pair->diff_sa.avg / per_spin_time) + pair->delay_bias);
+			}
+			fzsync_pair_info(pair);
+			fzsync_profile_save(pair);
+			pair->sampling = -1;
+		}
+	} else if (!pair->sampling) {
+		fzsync_printf("Can't calculate random delay");
+		fzsync_pair_info(pair);
+		pair->sampling = -1;
+	}
+
+	pair->delay_ns = pair->delay * per_spin_time;
+	pair->spins = 0;
+
+	if (pair->watchdog) {
+		fzsync_atomic_store(MIN(MAX(pair->diff_sa.avg, pair->diff_sb.avg),
+					INT_MAX), &pair->watchdog_window);
+	}
+}
+
+/** The minimum gap between scheduled attempts in nanoseconds */
+#define FZSYNC_TT_GAP 1000
+
+/**
+ * Spin on the clock until the target time
+ *
+ * @param target The time to wait for in nanoseconds
+ * @param now Set to the time the wait ended
+ *
+ * Yields while the target is more than FZSYNC_TT_GAP away, so that the
+ * other thread is not starved when both share a CPU.
+ *
+ * @return True if the target had already passed.
+ */
+static inline int fzsync_wait_until(long long target, struct timespec *now)
+{
+	int late;
+
+	fzsync_time(now);
+	late = fzsync_ts_ns(*now) >= target;
+
+	while (fzsync_ts_ns(*now) < target) {
+		if (target - fzsync_ts_ns(*now) > FZSYNC_TT_GAP)
+			fzsync_yield();
+		fzsync_time(now);
+	}
+
+	return late;
+}
+
+/**
+ * Arrive at the start of race barrier in timed release mode
+ *
+ * @relates fzsync_pair
+ *
+ * The last thread to arrive publishes the release time before it
+ * signals the other thread. So the release time is visible to both
+ * threads once they have passed the barrier.
+ */
+static inline void fzsync_release_arrive(struct fzsync_pair *pair)
+{
+	struct timespec now;
+
+	if (fzsync_atomic_inc(&pair->arrivals) & 1)
+		return;
+
+	fzsync_time(&now);
+	pair->release = fzsync_ts_ns(now) + pair->release_lead;
+}
+
+/**
+ * Wait in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pair_wait
+ */
+static inline void fzsync_wait_a(struct fzsync_pair *pair)
+{
+	fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, NULL);
+}
+
+/**
+ * Wait in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pair_wait
+ */
+static inline void fzsync_wait_b(struct fzsync_pair *pair)
+{
+	fzsync_pair_wait_exit(&pair->b_cntr, &pair->a_cntr, NULL, &pair->exit);
+}
+
+/**
+ * Move to the next placement which has suitable CPUs
+ *
+ * @relates fzsync_pair
+ *
+ * Called by thread A while thread B is at, or on its way to, the
+ * barrier. The CPUs were probed on reset, so this only pins the
+ * threads. The statistics of every region and phase are sampled again
+ * because the timings of one placement say little about another.
+ */
+static void fzsync_place_next(struct fzsync_pair *pair)
+{
+	enum fzsync_placement prev = pair->place, place = prev;
+
+	fzsync_place_account(pair);
+
+	do {
+		place = (place + 1) % FZSYNC_PLACE_MAX;
+	} while (fzsync_place(pair, place));
+
+	if (place == prev)
+		return;
+
+	fzsync_pair_reset_stats(pair);
+}
+
+/**
+ * Check the time limit and SIGTERM and write any checkpoint which is due
+ *
+ * @relates fzsync_pair
+ *
+ * Also ends the sampling period if it has taken too much of the time
+ * limit. Called by whichever thread does the bookkeeping.
+ *
+ * @return True to exit and false to continue.
+ */
+static int fzsync_pair_check_limits(struct fzsync_pair *pair)
+{
+	int exit = 0;
+	float rem = fzsync_timeout_remaining(pair);
+
+	if ((pair->exec_time * SAMPLING_SLICE > rem)
+		&& (pair->sampling > 0)) {
+		fzsync_printf("Stopped sampling at %d (out of %d) samples, "
+			      "sampling time reached 50%% of the total time limit",
+			      fzsync_atomic_load(&pair->exec_loop),
+			      pair->min_samples);
+		pair->sampling = 0;
+		fzsync_pair_info(pair);
+	}
+
+	if (!rem) {
+		fzsync_printf("Exceeded execution time, requesting exit");
+		exit = 1;
+	}
+
+	if (fzsync_sigterm) {
+		fzsync_printf("Received SIGTERM, requesting exit");
+		exit = 1;
+	}
+
+	if (pair->checkpoint_path)
+		fzsync_checkpoint_run(pair, exit);
+
+	return exit;
+}
+
+/**
+ * Start the next loop unless exec_loops has been reached
+ *
+ * @relates fzsync_pair
+ *
+ * The checkpoint is removed once all the loops have been run. In
+ * controller mode the controller removes it instead, after it has
+ * stopped writing checkpoints.
+ *
+ * @return True to exit and false to continue.
+ */
+static inline int fzsync_pair_next_loop(struct fzsync_pair *pair)
+{
+	fzsync_atomic_store(pair->exec_loop + 1, &pair->exec_loop);
+	if (pair->exec_loop <= pair->exec_loops)
+		return 0;
+
+	fzsync_printf("Exceeded execution loops, requesting exit");
+	if (pair->checkpoint_path && !pair->ctl_thread)
+		unlink(pair->checkpoint_path);
+
+	return 1;
+}
+
+/**
+ * Decide whether thread A should exit and tell thread B
+ *
+ * @relates fzsync_pair
+ *
+ * Checks some values and decides whether it is time to break the loop of
+ * thread A. The decision is stored in pair->exit, but thread B will only
+ * see it after the next barrier.
+ *
+ * @return True to exit and false to continue.
+ * @sa fzsync_run_a
+ */
+static inline int fzsync_pair_decide_exit(struct fzsync_pair *pair)
+{
+	int exit;
+
+	assert(!pair->ctl_thread);
+	exit = fzsync_pair_check_limits(pair);
+
+	if (pair->placement_loops && !exit
+	    && pair->exec_loop - pair->place_loop >= pair->placement_loops)
+		fzsync_place_next(pair);
+
+	exit |= fzsync_pair_next_loop(pair);
+	fzsync_atomic_store(exit, &pair->exit);
+
+	return exit;
+}
+
+/**
+ * Decide whether to continue running thread A
+ *
+ * @relates fzsync_pair
+ *
+ * @return True to continue and false to break.
+ * @sa fzsync_pair_decide_exit
+ */
+static inline int fzsync_run_a(struct fzsync_pair *pair)
+{
+	int exit = fzsync_pair_decide_exit(pair);
+
+	fzsync_wait_a(pair);
+
+	if (exit) {
+		fzsync_pair_cleanup(pair);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Check for the exit request in thread B and acknowledge it
+ *
+ * @relates fzsync_pair
+ *
+ * Setting b_done tells fzsync_pair_cleanup() that thread B is leaving
+ * its loop, however it was started.
+ *
+ * @return True if thread B should exit.
+ */
+static inline int fzsync_b_exiting(struct fzsync_pair *pair)
+{
+	if (!fzsync_atomic_load(&pair->exit))
+		return 0;
+
+	fzsync_atomic_store(1, &pair->b_done);
+
+	return 1;
+}
+
+/**
+ * Decide whether to continue running thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_run_a
+ */
+static inline int fzsync_run_b(struct fzsync_pair *pair)
+{
+	fzsync_wait_b(pair);
+	return !fzsync_b_exiting(pair);
+}
+
+/**
+ * Marks the start of a race region in thread A
+ *
+ * @relates fzsync_pair
+ *
+ * This should be placed just before performing whatever action can cause a
+ * race condition. Usually it is placed just before a syscall and
+ * fzsync_end_race_a() is placed just afterwards.
+ *
+ * A corresponding call to fzsync_start_race_b() should be made in thread
+ * B.
+ *
+ * Usually the thread which arrives last leaves the barrier immediately
+ * and the first one leaves when it notices. So the start times differ
+ * by at least one cache line transfer. If pair->release_lead is set,
+ * the last thread to arrive instead publishes a release time slightly
+ * in the future. Both threads then spin on the clock until that time
+ * plus their delay, which is converted to nanoseconds.
+ *
+ * @return A non-zero value if the calling thread should continue to loop. If
+ * it returns zero then fzsync_exit() has been called and you must exit
+ * the thread.
+ *
+ * @sa fzsync_pair_update
+ */
+static inline void fzsync_start_race_a(struct fzsync_pair *pair)
+{
+	volatile int delay;
+
+	fzsync_pair_update(pair);
+
+	if (pair->release_lead) {
+		fzsync_release_arrive(pair);
+		fzsync_wait_a(pair);
+		fzsync_wait_until(pair->release + MAX(-pair->delay_ns, 0LL),
+				  &pair->a_start);
+		return;
+	}
+
+	fzsync_wait_a(pair);
+
+	delay = pair->delay;
+	while (delay < 0)
+		delay++;
+
+	fzsync_time(&pair->a_start);
+}
+
+/**
+ * Classify the critical sections of the last race and count the result
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_cs_enter_a
+ */
+static inline void fzsync_cs_classify(struct fzsync_pair *pair)
+{
+	if (fzsync_diff_ns(pair->b_cs_enter, pair->a_cs_exit) > 0)
+		pair->cs_outcome = FZSYNC_BEFORE;
+	else if (fzsync_diff_ns(pair->a_cs_enter, pair->b_cs_exit) > 0)
+		pair->cs_outcome = FZSYNC_AFTER;
+	else
+		pair->cs_outcome = FZSYNC_OVERLAP;
+
+	fzsync_counter_inc(pair->outcomes + pair->cs_outcome);
+}
+
+/**
+ * Marks the end of a race region in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_start_race_a
+ */
+static inline void fzsync_end_race_a(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->a_end);
+	fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, &pair->spins);
+
+	if (pair->cs)
+		fzsync_cs_classify(pair);
+}
+
+/**
+ * Marks the start of a race region in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_start_race_a
+ */
+static inline void fzsync_start_race_b(struct fzsync_pair *pair)
+{
+	volatile int delay;
+
+	if (pair->release_lead) {
+		fzsync_release_arrive(pair);
+		fzsync_wait_b(pair);
+		fzsync_wait_until(pair->release + MAX(pair->delay_ns, 0LL),
+				  &pair->b_start);
+		return;
+	}
+
+	fzsync_wait_b(pair);
+
+	delay = pair->delay;
+	while (delay > 0)
+		delay--;
+
+	fzsync_time(&pair->b_start);
+}
+
+/**
+ * Marks the end of a race region in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_start_race_a
+ */
+static inline void fzsync_end_race_b(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->b_end);
+	fzsync_pair_wait_exit(&pair->b_cntr, &pair->a_cntr, &pair->spins,
+			      &pair->exit);
+}
+
+/**
+ * Marks the start of a race region in thread A
+ *
+ * @relates fzsync_pair
+ * @param region The region's index, less than FZSYNC_MAX_REGIONS
+ *
+ * Like fzsync_start_race_a(), but each region has its own statistics,
+ * sampling period, delay range and delay bias. This allows one pair of
+ * threads to alternate between different races without mixing their
+ * timings:
+ *
+ * while (fzsync_run_a(&pair)) {
+ *	region = pair.exec_loop % 2;
+ *	// Setup for either race
+ *	fzsync_start_region_a(&pair, region);
+ *	// Do one of two dodgy syscalls
+ *	fzsync_end_region_a(&pair, region);
+ * }
+ *
+ * Thread B must pass the same region to fzsync_start_region_b() and
+ * fzsync_end_region_b(). Thread B may read pair.exec_loop after
+ * fzsync_run_b() returns, so it is a convenient way to choose it.
+ *
+ * fzsync_start_race_a() uses whichever region was used last, which is
+ * zero after fzsync_pair_reset(). Only region zero is loaded from and
+ * saved to the timing profile cache.
+ */
+static inline void fzsync_start_region_a(struct fzsync_pair *pair, int region)
+{
+	assert(region >= 0 && region < FZSYNC_MAX_REGIONS);
+
+	pair->region_next = region;
+	fzsync_start_race_a(pair);
+}
+
+/**
+ * Marks the end of a race region in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_start_region_a
+ */
+static inline void fzsync_end_region_a(struct fzsync_pair *pair, int region)
+{
+	assert(region == pair->region);
+
+	fzsync_end_race_a(pair);
+}
+
+/**
+ * Marks the start of a race region in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_start_region_a
+ */
+static inline void fzsync_start_region_b(struct fzsync_pair *pair, int region)
+{
+	fzsync_start_race_b(pair);
+
+	assert(region == pair->region);
+}
+
+/**
+ * Marks the end of a race region in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_start_region_a
+ */
+static inline void fzsync_end_region_b(struct fzsync_pair *pair, int region)
+{
+	assert(region == pair->region);
+
+	fzsync_end_race_b(pair);
+}
+
+/**
+ * Record the time of a point inside the race in thread A
+ *
+ * @relates fzsync_pair
+ * @param mark The mark's index, less than FZSYNC_MAX_MARKS
+ *
+ * Only a clock read, no other thread is involved. Marks are recorded
+ * between fzsync_start_race_a() and fzsync_end_race_a() and can be used
+ * as alignment targets with fzsync_pair_align().
+ */
+static inline void fzsync_mark_a(struct fzsync_pair *pair, int mark)
+{
+	assert(mark >= 0 && mark < FZSYNC_MAX_MARKS);
+	fzsync_time(pair->a_marks + mark);
+}
+
+/**
+ * Record the time of a point inside the race in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_mark_a
+ */
+static inline void fzsync_mark_b(struct fzsync_pair *pair, int mark)
+{
+	assert(mark >= 0 && mark < FZSYNC_MAX_MARKS);
+	fzsync_time(pair->b_marks + mark);
+}
+
+/**
+ * Marks the entry to the critical section in thread A
+ *
+ * @relates fzsync_pair
+ *
+ * Instead of each test detecting the ordering of the critical sections
+ * with a shared counter, the threads can record when they enter and
+ * leave them:
+ *
+ * fzsync_start_race_a(&pair);
+ * setup_inside_syscall_a();
+ * fzsync_cs_enter_a(&pair);
+ * critical_section_a();
+ * fzsync_cs_exit_a(&pair);
+ * fzsync_end_race_a(&pair);
+ *
+ * Each thread only writes its own timestamps, so nothing is added to
+ * the race apart from the clock reads. After the end barrier
+ * fzsync_end_race_a() classifies the race as FZSYNC_BEFORE,
+ * FZSYNC_OVERLAP or FZSYNC_AFTER, counts it in the outcomes and
+ * makes it available from fzsync_cs_outcome(). The fused, batched and
+ * time-triggered modes do not classify races, so the critical sections
+ * can't be marked in them.
+ *
+ * The timestamps bracket the critical sections, so a race which only
+ * just misses may be classified as overlapping.
+ */
+static inline void fzsync_cs_enter_a(struct fzsync_pair *pair)
+{
+	assert(!pair->a_looping && !pair->batch_len);
+
+	pair->cs = 1;
+	fzsync_time(&pair->a_cs_enter);
+}
+
+/**
+ * Marks the exit from the critical section in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_cs_enter_a
+ */
+static inline void fzsync_cs_exit_a(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->a_cs_exit);
+}
+
+/**
+ * Marks the entry to the critical section in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_cs_enter_a
+ */
+static inline void fzsync_cs_enter_b(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->b_cs_enter);
+}
+
+/**
+ * Marks the exit from the critical section in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_cs_enter_a
+ */
+static inline void fzsync_cs_exit_b(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->b_cs_exit);
+}
+
+/**
+ * The classification of the last race
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_cs_enter_a
+ */
+static inline enum fzsync_outcome fzsync_cs_outcome(const struct fzsync_pair *pair)
+{
+	return pair->cs_outcome;
+}
+
+/**
+ * Centre the delays on aligning two marks
+ *
+ * @relates fzsync_pair
+ * @param mark_a The mark recorded by fzsync_mark_a() in thread A
+ * @param mark_b The mark recorded by fzsync_mark_b() in thread B
+ *
+ * By default the delay range lets any point of race A meet any point of
+ * race B. If it is known that the critical sections are near two marks,
+ * for example just after some setup inside each syscall, then this
+ * shrinks the range to a narrow spread around the delay which makes
+ * the marks happen at the same time:
+ *
+ * fzsync_start_race_a(&pair);
+ * setup_inside_syscall_a();
+ * fzsync_mark_a(&pair, 0);
+ * critical_section_a();
+ * fzsync_end_race_a(&pair);
+ *
+ * Call it before fzsync_pair_reset(). Every race must record both
+ * marks. The offset of each mark from the start of its race is sampled
+ * with the other statistics. The alignment applies to all regions.
+ *
+ * @sa fzsync_pair_align_time
+ */
+static inline void fzsync_pair_align(struct fzsync_pair *pair,
+				     int mark_a, int mark_b)
+{
+	assert(mark_a >= 0 && mark_a < FZSYNC_MAX_MARKS);
+	assert(mark_b >= 0 && mark_b < FZSYNC_MAX_MARKS);
+
+	pair->align = 1;
+	pair->align_a = mark_a;
+	pair->align_b = mark_b;
+}
+
+/**
+ * An intermediate sync point with its own delay in thread A
+ *
+ * @relates fzsync_pair
+ * @param phase The phase's index, less than FZSYNC_MAX_PHASES
+ *
+ * Some races need two points to be aligned. For example syscall A
+ * must overlap one part of syscall B and a later operation in A must
+ * overlap a later part of B. Each phase is a sync point between
+ * fzsync_start_race_a() and fzsync_end_race_a(). Both threads wait for
+ * each other there and then apply the phase's delay:
+ *
+ * fzsync_start_race_a(&pair);
+ * // Do the first dodgy syscall
+ * fzsync_phase_a(&pair, 0);
+ * // Do the second dodgy syscall
+ * fzsync_end_race_a(&pair);
+ *
+ * Thread B calls fzsync_phase_b() with the same phases in the same
+ * order. Every race must pass through the same phases.
+ *
+ * Each phase lasts until the next phase or the end of the race. Its
+ * timings are sampled with the race's and its delay range is
+ * calculated in the same way. The delays of the start and of each phase
+ * are then taken together from a Halton sequence, see
+ * fzsync_phase_delays().
+ *
+ * The phases belong to the pair and not to a region. So if races in
+ * more than one region use phases, their timings are mixed together.
+ */
+static inline void fzsync_phase_a(struct fzsync_pair *pair, int phase)
+{
+	struct fzsync_phase *p = pair->phases + phase;
+	volatile int delay;
+
+	assert(phase >= 0 && phase < FZSYNC_MAX_PHASES);
+	pair->phase_n = MAX(pair->phase_n, phase + 1);
+
+	fzsync_time(&p->a_arrive);
+	fzsync_wait_a(pair);
+
+	delay = p->delay;
+	while (delay < 0)
+		delay++;
+
+	fzsync_time(&p->a_start);
+}
+
+/**
+ * An intermediate sync point with its own delay in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_phase_a
+ */
+static inline void fzsync_phase_b(struct fzsync_pair *pair, int phase)
+{
+	struct fzsync_phase *p = pair->phases + phase;
+	volatile int delay;
+
+	assert(phase >= 0 && phase < FZSYNC_MAX_PHASES);
+	fzsync_time(&p->b_arrive);
+	fzsync_wait_b(pair);
+
+	delay = p->delay;
+	while (delay > 0)
+		delay--;
+
+	fzsync_time(&p->b_start);
+}
+
+/**
+ * Run one iteration of a fused loop in thread A
+ *
+ * @relates fzsync_pair
+ *
+ * Combines fzsync_end_race_a(), fzsync_run_a() and
+ * fzsync_start_race_a() for races where nothing needs to happen between
+ * the end of one race and the start of the next. Which is often the
+ * case when the setup can be done inside the race window.
+ *
+ * while (fzsync_loop_a(&pair)) {
+ *	// Do some dodgy syscall
+ * }
+ *
+ * And in thread B:
+ *
+ * while (fzsync_loop_b(&pair)) {
+ *	// Do something which can race with the dodgy syscall in A
+ * }
+ *
+ * The end of race barrier doubles as the run barrier. This leaves two
+ * barriers per iteration instead of three. The exit decision is made
+ * after the end of race barrier, so that thread B's spins don't include
+ * thread A's bookkeeping. Thread B can't know about it yet and always
+ * goes on to the start barrier. So thread A passes the start barrier
+ * even when exiting and thread B sees the decision after it.
+ * Leaving the loop by other means requires calling fzsync_pair_reset()
+ * before looping again.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_loop_a(struct fzsync_pair *pair)
+{
+	int exit;
+
+	if (pair->a_looping) {
+		fzsync_time(&pair->a_end);
+		fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, &pair->spins);
+		exit = fzsync_pair_decide_exit(pair);
+	} else {
+		exit = fzsync_pair_decide_exit(pair);
+		fzsync_wait_a(pair);
+	}
+
+	if (exit) {
+		/* Thread B went on to the start barrier, release it */
+		if (pair->a_looping)
+			fzsync_wait_a(pair);
+		pair->a_looping = 0;
+		fzsync_pair_cleanup(pair);
+		return 0;
+	}
+
+	pair->a_looping = 1;
+	fzsync_start_race_a(pair);
+
+	return 1;
+}
+
+/**
+ * Run one iteration of a fused loop in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_loop_a
+ */
+static inline int fzsync_loop_b(struct fzsync_pair *pair)
+{
+	if (pair->b_looping) {
+		fzsync_time(&pair->b_end);
+		fzsync_pair_wait_exit(&pair->b_cntr, &pair->a_cntr,
+				      &pair->spins, &pair->exit);
+		fzsync_start_race_b(pair);
+	} else {
+		fzsync_wait_b(pair);
+		if (!fzsync_atomic_load(&pair->exit))
+			fzsync_start_race_b(pair);
+	}
+
+	if (fzsync_b_exiting(pair)) {
+		pair->b_looping = 0;
+		return 0;
+	}
+
+	pair->b_looping = 1;
+
+	return 1;
+}
+
+/** Time given to thread B to read a new schedule in nanoseconds */
+#define FZSYNC_TT_LEAD 20000
+
+/**
+ * The number of attempts in the next batch
+ *
+ * @relates fzsync_pair
+ *
+ * Called before fzsync_run_a() starts the batch's first loop. The last
+ * batch is cut short so that exec_loop does not exceed exec_loops.
+ */
+static int fzsync_batch_next_len(const struct fzsync_pair *pair)
+{
+	return MAX(MIN(pair->batch, pair->exec_loops - pair->exec_loop), 1);
+}
+
+/**
+ * Add the timings of a time-triggered batch to the statistics
+ *
+ * @relates fzsync_pair
+ *
+ * There are no barriers, so spins_avg is left as it is.
+ *
+ * Also adapts the period between attempts. If either thread was late
+ * for too many attempts then the period is increased. If no thread was
+ * late the period is reduced towards the minimum set by
+ * fzsync_tt_schedule().
+ */
+static void fzsync_tt_ingest(struct fzsync_pair *pair)
+{
+	const struct fzsync_times *a, *b;
+	int i, late = 0;
+
+	for (i = 0; i < pair->batch_len; i++) {
+		a = pair->a_times + i;
+		b = pair->b_times + i;
+		late += a->late || b->late;
+
+		if (pair->sampling > 0 || fzsync_pair_over_max_dev(pair))
+			fzsync_pair_sample(pair, a->start, b->start,
+					   a->end, b->end);
+	}
+
+	if (late > pair->batch_len / 8)
+		pair->tt_period *= 1.5;
+	else if (!late)
+		pair->tt_period *= 0.95;
+}
+
+/**
+ * Calculate the start time, period and delays of the next batch
+ *
+ * @relates fzsync_pair
+ *
+ * The delays are in nanoseconds and taken from the same range as
+ * fzsync_pair_update(). The period must at least be long enough for
+ * the longest delay plus both race windows.
+ *
+ * The delay bias is measured in spins, so it can only come from a
+ * timing profile saved by the barrier based API. It is converted with
+ * that profile's spin time.
+ */
+static void fzsync_tt_schedule(struct fzsync_pair *pair)
+{
+	float window = 1.1 * (fabsf(pair->diff_sa.avg) + fabsf(pair->diff_sb.avg));
+	float bias = pair->delay_bias * fabsf(pair->diff_ab.avg)
+		/ MAX(pair->spins_avg.avg, 1.0f);
+	int i, random = pair->sampling <= 0 && !fzsync_pair_over_max_dev(pair);
+	struct timespec now;
+
+	pair->batch_len = fzsync_batch_next_len(pair);
+	pair->tt_period = MAX(pair->tt_period,
+			      window + fabsf(bias) + FZSYNC_TT_GAP);
+
+	for (i = 0; i < pair->batch_len; i++) {
+		pair->batch_delays[i] = bias;
+		if (random)
+			pair->batch_delays[i] += fzsync_pair_rand_time(pair);
+	}
+
+	if (random && !pair->sampling) {
+		fzsync_printf("Reached deviation ratios < %.2f, introducing randomness",
+			      pair->max_dev_ratio);
+		fzsync_printf("Delay range is [%dns, %dns], period is %.0fns",
+			      -(int)(1.1 * pair->diff_sb.avg + bias),
+			      (int)(1.1 * pair->diff_sa.avg + bias), pair->tt_period);
+		fzsync_pair_info(pair);
+		pair->sampling = -1;
+	}
+
+	fzsync_time(&now);
+	pair->tt_t0 = fzsync_ts_ns(now) + pair->tt_period + FZSYNC_TT_LEAD;
+}
+
+/**
+ * Decide whether to continue running thread A in time-triggered mode
+ *
+ * @relates fzsync_pair
+ *
+ * The time-triggered mode removes the barriers from each iteration. At
+ * the start of each batch thread A publishes a schedule: a start time,
+ * a period and a delay for each attempt. Both threads then spin on the
+ * clock until their scheduled start time and record their timings in
+ * their own slots. The slots are only read, and the statistics updated,
+ * at the start of the next batch:
+ *
+ * while (fzsync_tt_run_a(&pair)) {
+ *	// Perform some short setup
+ *	fzsync_tt_start_race_a(&pair);
+ *	// Do some dodgy syscall
+ *	fzsync_tt_end_race_a(&pair);
+ * }
+ *
+ * Thread B uses the corresponding _b functions. This requires both
+ * threads to be on separate CPUs and the race windows to be fairly
+ * consistent. Any setup must fit inside the period between attempts;
+ * when either thread is late the period is increased.
+ *
+ * Each attempt costs at least the period, so this only pays off when
+ * the barriers of fzsync_run_a() and fzsync_start_race_a() are a
+ * large part of an iteration. When the threads share a CPU they must
+ * take turns and each attempt also costs a context switch. For example
+ * a_rare_data_race takes about twice as long with -t on one CPU.
+ *
+ * The time limit is only checked at the start of each batch. The last
+ * batch is cut short to end at exec_loops. A timing profile is loaded
+ * by fzsync_pair_reset() as usual, but is not saved because spins_avg
+ * is not measured. Likewise fzsync_pair_add_bias() may not be used.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_tt_run_a(struct fzsync_pair *pair)
+{
+	if (pair->a_attempt >= 0 && pair->a_attempt + 1 < pair->batch_len) {
+		pair->a_attempt++;
+		fzsync_atomic_store(pair->exec_loop + 1, &pair->exec_loop);
+		return 1;
+	}
+
+	if (pair->a_attempt >= 0) {
+		fzsync_wait_a(pair);
+		fzsync_tt_ingest(pair);
+	}
+
+	pair->tt = 1;
+	fzsync_tt_schedule(pair);
+	pair->a_attempt = 0;
+
+	return fzsync_run_a(pair);
+}
+
+/**
+ * Decide whether to continue running thread B in time-triggered mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_tt_run_a
+ */
+static inline int fzsync_tt_run_b(struct fzsync_pair *pair)
+{
+	if (pair->b_attempt >= 0 && pair->b_attempt + 1 < pair->batch_len) {
+		pair->b_attempt++;
+		return 1;
+	}
+
+	if (pair->b_attempt >= 0)
+		fzsync_wait_b(pair);
+
+	pair->b_attempt = 0;
+
+	return fzsync_run_b(pair);
+}
+
+/**
+ * Wait for the scheduled start of the race in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_tt_run_a
+ */
+static inline void fzsync_tt_start_race_a(struct fzsync_pair *pair)
+{
+	int i = pair->a_attempt;
+	long long target = pair->tt_t0 + (long long)(i * pair->tt_period);
+
+	pair->a_times[i].late =
+		fzsync_wait_until(target + MAX(-pair->batch_delays[i], 0),
+				  &pair->a_times[i].start);
+	pair->a_start = pair->a_times[i].start;
+}
+
+/**
+ * Marks the end of a time-triggered race in thread A
+ *
+ * @relates fzsync_pair
+ *
+ * Does not wait for thread B. So pair->b_end and pair->b_start may
+ * still be from a previous attempt.
+ *
+ * @sa fzsync_tt_run_a
+ */
+static inline void fzsync_tt_end_race_a(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->a_times[pair->a_attempt].end);
+	pair->a_end = pair->a_times[pair->a_attempt].end;
+}
+
+/**
+ * Wait for the scheduled start of the race in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_tt_run_a
+ */
+static inline void fzsync_tt_start_race_b(struct fzsync_pair *pair)
+{
+	int i = pair->b_attempt;
+	long long target = pair->tt_t0 + (long long)(i * pair->tt_period);
+
+	pair->b_times[i].late =
+		fzsync_wait_until(target + MAX(pair->batch_delays[i], 0),
+				  &pair->b_times[i].start);
+	pair->b_start = pair->b_times[i].start;
+}
+
+/**
+ * Marks the end of a time-triggered race in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_tt_end_race_a
+ */
+static inline void fzsync_tt_end_race_b(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->b_times[pair->b_attempt].end);
+	pair->b_end = pair->b_times[pair->b_attempt].end;
+}
+
+/**
+ * Wait for the other thread using single writer sequence numbers
+ *
+ * @relates fzsync_pair
+ * @param our_seq The sequence number of the thread we are on
+ * @param other_seq The sequence number of the thread we are waiting for
+ * @param spins A pointer to the spin counter or NULL
+ * @param exit A pointer to the exit flag or NULL, see fzsync_pair_wait_exit()
+ *
+ * A lighter alternative to fzsync_pair_wait() used between the
+ * attempts of a batch. Each thread only stores to its own sequence
+ * number, so there are no atomic read-modify-write operations. The
+ * comparison is done on the difference so that wrapping is harmless.
+ */
+static inline void fzsync_seq_wait(int *our_seq, int *other_seq, int *spins,
+				   int *exit)
+{
+	unsigned int seq = (unsigned int)*our_seq + 1;
+
+	fzsync_atomic_store(seq, our_seq);
+
+	while ((int)((unsigned int)fzsync_atomic_load(other_seq) - seq) < 0
+	       && !fzsync_exiting(exit)) {
+		if (spins)
+			(*spins)++;
+
+		fzsync_yield();
+	}
+}
+
+/**
+ * Add the last batch to the statistics and calculate the next delays
+ *
+ * @relates fzsync_pair
+ *
+ * Each attempt's timings are copied into the pair and passed to
+ * fzsync_pair_update() as if they were a normal iteration. So the
+ * statistics and delays are the same as without batching, they are
+ * just calculated all at once. For the first batch there are no
+ * timings and only the delay bias is used. If the next batch is the
+ * last and shorter, the whole of the previous batch is still read.
+ */
+static void fzsync_batch_update(struct fzsync_pair *pair)
+{
+	const struct fzsync_times *a, *b;
+	int i, last_len = pair->batch_len;
+
+	pair->batch_len = fzsync_batch_next_len(pair);
+
+	for (i = 0; i < MAX(pair->batch_len, last_len); i++) {
+		if (i >= last_len) {
+			pair->batch_delays[i] = pair->delay_bias;
+			continue;
+		}
+
+		a = pair->a_times + i;
+		b = pair->b_times + i;
+		pair->a_start = a->start;
+		pair->b_start = b->start;
+		pair->a_end = a->end;
+		pair->b_end = b->end;
+		pair->spins = a->spins + b->spins;
+
+		fzsync_pair_update(pair);
+		pair->batch_delays[i] = pair->delay;
+	}
+}
+
+/**
+ * Decide whether to continue running thread A in batched mode
+ *
+ * @relates fzsync_pair
+ *
+ * In batched mode fzsync_batch_run_a() hands out pair->batch race
+ * attempts with precomputed delays. Between attempts the threads are
+ * aligned with fzsync_seq_wait() instead of the full barrier. The
+ * timings are recorded in per-attempt slots and the full barriers,
+ * statistics update and delay calculation only happen once per batch:
+ *
+ * while (fzsync_batch_run_a(&pair)) {
+ *	// Perform some setup which must happen before the race
+ *	fzsync_batch_start_race_a(&pair);
+ *	// Do some dodgy syscall
+ *	fzsync_batch_end_race_a(&pair);
+ * }
+ *
+ * Thread B uses the corresponding _b functions. The time limit is
+ * only checked at the start of each batch. The last batch is cut short
+ * to end at exec_loops.
+ *
+ * Each thread stores its spin count after its last wait of an
+ * attempt, so the slots are only read after an extra full barrier at
+ * the end of the batch.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_batch_run_a(struct fzsync_pair *pair)
+{
+	if (pair->a_attempt >= 0 && pair->a_attempt + 1 < pair->batch_len) {
+		pair->a_attempt++;
+		fzsync_atomic_store(pair->exec_loop + 1, &pair->exec_loop);
+		return 1;
+	}
+
+	if (pair->a_attempt >= 0)
+		fzsync_wait_a(pair);
+
+	fzsync_batch_update(pair);
+	pair->a_attempt = 0;
+
+	return fzsync_run_a(pair);
+}
+
+/**
+ * Decide whether to continue running thread B in batched mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_batch_run_a
+ */
+static inline int fzsync_batch_run_b(struct fzsync_pair *pair)
+{
+	if (pair->b_attempt >= 0 && pair->b_attempt + 1 < pair->batch_len) {
+		pair->b_attempt++;
+		return 1;
+	}
+
+	if (pair->b_attempt >= 0)
+		fzsync_wait_b(pair);
+
+	pair->b_attempt = 0;
+
+	return fzsync_run_b(pair);
+}
+
+/**
+ * Marks the start of a batched race attempt in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_batch_run_a
+ */
+static inline void fzsync_batch_start_race_a(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times = pair->a_times + pair->a_attempt;
+	volatile int delay;
+
+	fzsync_seq_wait(&pair->a_seq, &pair->b_seq, NULL, NULL);
+
+	delay = pair->batch_delays[pair->a_attempt];
+	while (delay < 0)
+		delay++;
+
+	fzsync_time(&times->start);
+}
+
+/**
+ * Marks the end of a batched race attempt in thread A
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_batch_run_a
+ */
+static inline void fzsync_batch_end_race_a(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times = pair->a_times + pair->a_attempt;
+	int spins = 0;
+
+	fzsync_time(&times->end);
+	fzsync_seq_wait(&pair->a_seq, &pair->b_seq, &spins, NULL);
+	times->spins = spins;
+}
+
+/**
+ * Marks the start of a batched race attempt in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_batch_run_a
+ */
+static inline void fzsync_batch_start_race_b(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times = pair->b_times + pair->b_attempt;
+	volatile int delay;
+
+	fzsync_seq_wait(&pair->b_seq, &pair->a_seq, NULL, &pair->exit);
+
+	delay = pair->batch_delays[pair->b_attempt];
+	while (delay > 0)
+		delay--;
+
+	fzsync_time(&times->start);
+}
+
+/**
+ * Marks the end of a batched race attempt in thread B
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_batch_run_a
+ */
+static inline void fzsync_batch_end_race_b(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times = pair->b_times + pair->b_attempt;
+	int spins = 0;
+
+	fzsync_time(&times->end);
+	fzsync_seq_wait(&pair->b_seq, &pair->a_seq, &spins, &pair->exit);
+	times->spins = spins;
+}
+
+/** How many loops ahead the controller schedules each delay */
+#define FZSYNC_CTL_AHEAD (FZSYNC_MAX_BATCH / 2)
+
+/**
+ * Read the slots of the loops which both threads have finished
+ *
+ * @relates fzsync_pair
+ *
+ * Each loop's timings are copied into the pair and passed to
+ * fzsync_pair_update() as in fzsync_batch_update(). The resulting
+ * delay is stored in the slot of a loop FZSYNC_CTL_AHEAD in the
+ * future, so that thread A usually finds a fresh delay without ever
+ * waiting for the controller.
+ *
+ * The slots are reused every FZSYNC_MAX_BATCH loops. A slot is checked
+ * for reuse after it has been copied and, if thread A has lapped the
+ * controller, the loop is counted as lost instead.
+ *
+ * @return The number of loops read.
+ */
+static int fzsync_ctl_ingest(struct fzsync_pair *pair)
+{
+	const struct fzsync_times *a, *b;
+	int i, slot, done;
+
+	done = MIN(fzsync_atomic_load(&pair->ctl_a_done),
+		   fzsync_atomic_load(&pair->ctl_b_done));
+
+	for (i = pair->ctl_seq + 1; i <= done; i++) {
+		slot = i % FZSYNC_MAX_BATCH;
+		a = pair->a_times + slot;
+		b = pair->b_times + slot;
+		pair->a_start = a->start;
+		pair->b_start = b->start;
+		pair->a_end = a->end;
+		pair->b_end = b->end;
+		pair->spins = a->spins + b->spins;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (fzsync_atomic_load(&pair->exec_loop) - i >= FZSYNC_MAX_BATCH) {
+			pair->ctl_lost++;
+			continue;
+		}
+
+		fzsync_pair_update(pair);
+		fzsync_atomic_store(pair->delay, pair->batch_delays
+				    + (i + FZSYNC_CTL_AHEAD) % FZSYNC_MAX_BATCH);
+	}
+
+	i = done - pair->ctl_seq;
+	pair->ctl_seq = done;
+
+	return i;
+}
+
+/**
+ * The body of the controller thread
+ *
+ * @relates fzsync_pair
+ *
+ * Reads the finished loops, updates the statistics and delays, prints
+ * any messages and checks the time limit, SIGTERM and checkpoints.
+ * When it decides to exit it sets ctl_exit, which thread A passes on
+ * to thread B at the next barrier. After being stopped it reads the
+ * remaining loops once more so that none are missed.
+ *
+ * Once either thread A or the controller has decided to exit, no more
+ * checkpoints are written. If thread A ran all of the loops, the
+ * controller then removes the checkpoint, so that a late checkpoint
+ * can't outlive a finished run.
+ */
+static void *fzsync_ctl_main(void *arg)
+{
+	struct fzsync_pair *pair = arg;
+	int stop;
+
+	if (pair->controller_nice)
+		setpriority(PRIO_PROCESS, syscall(SYS_gettid), pair->controller_nice);
+
+	do {
+		stop = fzsync_atomic_load(&pair->ctl_stop);
+
+		if (!fzsync_ctl_ingest(pair) && !stop)
+			fzsync_yield();
+
+		if (stop || pair->ctl_exit || fzsync_atomic_load(&pair->exit))
+			continue;
+
+		if (fzsync_pair_check_limits(pair))
+			fzsync_atomic_store(1, &pair->ctl_exit);
+	} while (!stop);
+
+	if (pair->checkpoint_path
+	    && fzsync_atomic_load(&pair->exec_loop) > pair->exec_loops)
+		unlink(pair->checkpoint_path);
+
+	return NULL;
+}
+
+/**
+ * Start the controller thread
+ *
+ * @relates fzsync_pair
+ * @returns Zero or the result of pthread_create()
+ *
+ * The controller is not pinned. If thread A has been placed, then the
+ * controller would inherit its CPU, so it is given thread A's previous
+ * affinity without the CPUs of threads A and B instead. Unless that
+ * leaves no CPUs.
+ */
+static int fzsync_ctl_start(struct fzsync_pair *pair)
+{
+	int i;
+#ifdef CPU_SETSIZE
+	cpu_set_t set;
+#endif
+
+	pair->ctl_stop = 0;
+	pair->ctl_exit = 0;
+	pair->ctl_seq = pair->exec_loop;
+	pair->ctl_lost = 0;
+	pair->ctl_a_done = pair->exec_loop;
+	pair->ctl_b_done = pair->exec_loop;
+	for (i = 0; i < FZSYNC_MAX_BATCH; i++)
+		pair->batch_delays[i] = pair->delay_bias;
+
+	i = pthread_create(&pair->ctl_thread, NULL, fzsync_ctl_main, pair);
+	if (i) {
+		pair->ctl_thread = 0;
+		return i;
+	}
+
+#ifdef CPU_SETSIZE
+	if (pair->a_placed) {
+		CPU_ZERO(&set);
+		memcpy(&set, pair->a_affinity,
+		       MIN(sizeof(set), sizeof(pair->a_affinity)));
+		if (CPU_COUNT(&set) > 2) {
+			CPU_CLR(pair->cpu_a, &set);
+			CPU_CLR(pair->cpu_b, &set);
+		}
+		pthread_setaffinity_np(pair->ctl_thread, sizeof(set), &set);
+	}
+#endif
+
+	return 0;
+}
+
+/**
+ * Decide whether to continue running thread A in controller mode
+ *
+ * @relates fzsync_pair
+ *
+ * In controller mode a third thread does the bookkeeping which thread
+ * A normally does in fzsync_run_a() and fzsync_start_race_a(). It
+ * updates the statistics, calculates the delays, prints any messages
+ * and checks the time limit. So threads A and B are left with the
+ * barriers, the delay and their timestamps:
+ *
+ * while (fzsync_ctl_run_a(&pair)) {
+ *	// Perform some setup which must happen before the race
+ *	fzsync_ctl_start_race_a(&pair);
+ *	// Do some dodgy syscall
+ *	fzsync_ctl_end_race_a(&pair);
+ * }
+ *
+ * Thread B uses the corresponding _b functions. The controller is
+ * started by the first call and stopped by fzsync_pair_cleanup().
+ *
+ * The threads only communicate with the controller through fields
+ * which have a single writer. Each loop's timings are written to the
+ * batch slots and the last finished loop to ctl_a_done and
+ * ctl_b_done. The controller writes the delays to batch_delays and
+ * its exit decision to ctl_exit. Thread A hands the delay of each loop
+ * to thread B before the first barrier, so both use the same one.
+ *
+ * The controller may fall behind. Then thread A uses an older delay
+ * and loops which were overwritten before they were read are counted
+ * in ctl_lost. The loop limit is still checked by thread A, so that it
+ * is exact. Region, phase and placement rotation are not supported
+ * and neither is the timed release.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_ctl_run_a(struct fzsync_pair *pair)
+{
+	int exit;
+
+	if (!pair->ctl_thread && fzsync_ctl_start(pair)) {
+		fzsync_printf("Can't start the controller thread");
+		exit = 1;
+	} else {
+		exit = fzsync_atomic_load(&pair->ctl_exit);
+		exit |= fzsync_pair_next_loop(pair);
+	}
+
+	pair->ctl_delay = fzsync_atomic_load(pair->batch_delays
+					     + pair->exec_loop % FZSYNC_MAX_BATCH);
+	fzsync_atomic_store(exit, &pair->exit);
+	fzsync_wait_a(pair);
+
+	if (exit) {
+		fzsync_pair_cleanup(pair);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Decide whether to continue running thread B in controller mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_ctl_run_a
+ */
+static inline int fzsync_ctl_run_b(struct fzsync_pair *pair)
+{
+	fzsync_wait_b(pair);
+	pair->ctl_b_loop = fzsync_atomic_load(&pair->exec_loop);
+
+	return !fzsync_b_exiting(pair);
+}
+
+/**
+ * Marks the start of a race in thread A in controller mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_ctl_run_a
+ */
+static inline void fzsync_ctl_start_race_a(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times =
+		pair->a_times + pair->exec_loop % FZSYNC_MAX_BATCH;
+	volatile int delay;
+
+	fzsync_wait_a(pair);
+
+	delay = pair->ctl_delay;
+	while (delay < 0)
+		delay++;
+
+	fzsync_time(&times->start);
+}
+
+/**
+ * Marks the end of a race in thread A in controller mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_ctl_run_a
+ */
+static inline void fzsync_ctl_end_race_a(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times =
+		pair->a_times + pair->exec_loop % FZSYNC_MAX_BATCH;
+	int spins = 0;
+
+	fzsync_time(&times->end);
+	fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, &spins);
+	times->spins = spins;
+	fzsync_atomic_store(pair->exec_loop, &pair->ctl_a_done);
+
+	if (pair->cs)
+		fzsync_cs_classify(pair);
+}
+
+/**
+ * Marks the start of a race in thread B in controller mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_ctl_run_a
+ */
+static inline void fzsync_ctl_start_race_b(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times =
+		pair->b_times + pair->ctl_b_loop % FZSYNC_MAX_BATCH;
+	volatile int delay;
+
+	fzsync_wait_b(pair);
+
+	delay = pair->ctl_delay;
+	while (delay > 0)
+		delay--;
+
+	fzsync_time(&times->start);
+}
+
+/**
+ * Marks the end of a race in thread B in controller mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_ctl_run_a
+ */
+static inline void fzsync_ctl_end_race_b(struct fzsync_pair *pair)
+{
+	struct fzsync_times *times =
+		pair->b_times + pair->ctl_b_loop % FZSYNC_MAX_BATCH;
+	int spins = 0;
+
+	fzsync_time(&times->end);
+	fzsync_pair_wait_exit(&pair->b_cntr, &pair->a_cntr, &spins,
+			      &pair->exit);
+	times->spins = spins;
+	fzsync_atomic_store(pair->ctl_b_loop, &pair->ctl_b_done);
+}
+
+/**
+ * Decide whether to continue running thread A in uniprocessor mode
+ *
+ * @relates fzsync_pair
+ *
+ * When both threads share one CPU, only one of them runs at a time and
+ * the spinning barriers leave it to the scheduler which one that is.
+ * In uniprocessor mode the threads instead hand the CPU to each other
+ * with a futex, so they never spin:
+ *
+ * while (fzsync_up_run_a(&pair)) {
+ *	// Perform some setup which must happen before the race
+ *	fzsync_up_start_race_a(&pair);
+ *	// Do some dodgy syscall
+ *	fzsync_up_end_race_a(&pair);
+ * }
+ *
+ * Thread B uses the corresponding _b functions. Thread B does its setup
+ * first, then thread A. At the start of the race both threads are
+ * allowed to run. The delayed thread runs the delay loop, the other is
+ * the leader and goes straight into its race.
+ *
+ * If permitted, both threads are switched to SCHED_FIFO on the first
+ * call and the leader is given the higher priority. So the delayed
+ * thread only runs when the leader blocks inside its race and is
+ * preempted again as soon as the leader wakes up. The delay is then
+ * the amount of work the delayed thread does in the leader's gap
+ * before its own race starts. Without SCHED_FIFO the scheduler's
+ * wakeup preemption decides when the delayed thread runs.
+ *
+ * The delay is counted in loops of the same length as the delay
+ * loop, which is timed once. No spins are counted, so the timing
+ * profile is loaded as usual but not saved. Both threads should be on
+ * the same CPU, a spinning SCHED_FIFO thread can otherwise starve
+ * other tasks on its CPU.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_up_run_a(struct fzsync_pair *pair)
+{
+	int exit;
+
+	if (!pair->up)
+		fzsync_up_setup(pair);
+
+	exit = fzsync_pair_decide_exit(pair);
+	fzsync_up_pass(pair, FZSYNC_UP_B);
+
+	if (exit) {
+		fzsync_pair_cleanup(pair);
+		return 0;
+	}
+
+	fzsync_up_wait(pair, FZSYNC_UP_A, NULL);
+
+	return 1;
+}
+
+/**
+ * Decide whether to continue running thread B in uniprocessor mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_up_run_a
+ */
+static inline int fzsync_up_run_b(struct fzsync_pair *pair)
+{
+	fzsync_up_wait(pair, FZSYNC_UP_B, &pair->exit);
+
+	return !fzsync_b_exiting(pair);
+}
+
+/**
+ * Marks the start of a race in thread A in uniprocessor mode
+ *
+ * @relates fzsync_pair
+ *
+ * Calculates the delay, gives the leader the higher priority and lets
+ * both threads run.
+ *
+ * @sa fzsync_up_run_a
+ */
+static inline void fzsync_up_start_race_a(struct fzsync_pair *pair)
+{
+	volatile int delay;
+	int leader;
+
+	fzsync_pair_update(pair);
+
+	leader = pair->delay < 0;
+	if (pair->up_fifo && leader != pair->up_leader) {
+		fzsync_up_prio(pair, leader, 2);
+		fzsync_up_prio(pair, !leader, 1);
+		pair->up_leader = leader;
+	}
+
+	fzsync_up_pass(pair, FZSYNC_UP_BOTH);
+
+	delay = pair->delay;
+	while (delay < 0)
+		delay++;
+
+	fzsync_time(&pair->a_start);
+}
+
+/**
+ * Marks the end of a race in thread A in uniprocessor mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_up_run_a
+ */
+static inline void fzsync_up_end_race_a(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->a_end);
+	fzsync_up_wait(pair, FZSYNC_UP_A, NULL);
+
+	if (pair->cs)
+		fzsync_cs_classify(pair);
+}
+
+/**
+ * Marks the start of a race in thread B in uniprocessor mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_up_run_a
+ */
+static inline void fzsync_up_start_race_b(struct fzsync_pair *pair)
+{
+	volatile int delay;
+
+	fzsync_up_pass(pair, FZSYNC_UP_A);
+	fzsync_up_wait(pair, FZSYNC_UP_BOTH, &pair->exit);
+
+	delay = pair->delay;
+	while (delay > 0)
+		delay--;
+
+	fzsync_time(&pair->b_start);
+}
+
+/**
+ * Marks the end of a race in thread B in uniprocessor mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_up_run_a
+ */
+static inline void fzsync_up_end_race_b(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->b_end);
+	fzsync_up_pass(pair, FZSYNC_UP_A);
+}
+
+/** Time given to thread A to set the timer in nanoseconds */
+#define FZSYNC_TM_LEAD 5000
+
+/**
+ * Set the timer to expire at a time taken from fzsync_time()
+ *
+ * @relates fzsync_pair
+ *
+ * The timer can't use CLOCK_MONOTONIC_RAW, so it is set relative to the
+ * current time. The difference between the clocks over a few
+ * microseconds is negligible.
+ */
+static inline void fzsync_tm_arm(struct fzsync_pair *pair, long long expiry)
+{
+	struct itimerspec its;
+	struct timespec now;
+	long long rel;
+
+	fzsync_time(&now);
+	rel = MAX(expiry - fzsync_ts_ns(now), 1LL);
+	pair->tm_expiry = fzsync_ts_ns(now) + rel;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = rel / 1000000000;
+	its.it_value.tv_nsec = rel % 1000000000;
+	timer_settime(pair->tm_timer, 0, &its, NULL);
+}
+
+/**
+ * Add the last loop to the statistics and decide how to fire the timer
+ *
+ * @relates fzsync_pair
+ *
+ * While sampling, the timer fires after thread A's race, so that the
+ * race windows are measured without the handler in them.
+ */
+static void fzsync_tm_update(struct fzsync_pair *pair)
+{
+	int sample = pair->sampling > 0 || fzsync_pair_over_max_dev(pair);
+
+	if (pair->tm_fired && sample) {
+		fzsync_pair_sample(pair, pair->a_start, pair->b_start,
+				   pair->a_end, pair->b_end);
+	}
+
+	if (!sample && !pair->sampling) {
+		fzsync_printf("Reached deviation ratios < %.2f, introducing randomness",
+			      pair->max_dev_ratio);
+		fzsync_printf("Timer offset range is [%dns, %dns]",
+			      -(int)(1.1 * pair->diff_sb.avg),
+			      (int)(1.1 * pair->diff_sa.avg));
+		fzsync_pair_info(pair);
+		pair->sampling = -1;
+	}
+
+	pair->tm_sample = sample;
+	pair->tm_fired = 0;
+}
+
+/**
+ * Decide whether to continue running thread A in timer mode
+ *
+ * @relates fzsync_pair
+ *
+ * Many races are between a syscall and an asynchronous event, such as
+ * the delivery of a signal. In timer mode there is no thread B,
+ * instead a POSIX timer signals thread A and the signal handler calls
+ * timer_event:
+ *
+ * fzsync_pair_reset(&pair, NULL);
+ * while (fzsync_tm_run_a(&pair)) {
+ *	// Perform some setup which must happen before the race
+ *	fzsync_tm_start_race_a(&pair);
+ *	// Do some dodgy syscall
+ *	fzsync_tm_end_race_a(&pair);
+ * }
+ *
+ * The timer is created on the first call and deleted by
+ * fzsync_pair_cleanup(). The handler's start and end times take the
+ * place of thread B's, so diff_sb is the length of the handler. Once
+ * sampling has finished, thread A waits until a start time in the near
+ * future and the timer is set, so that the handler starts at a random
+ * offset from thread A's start. The offsets are taken from the same
+ * range as the delays of fzsync_pair_update(), with the average timer
+ * latency, which is also learned, subtracted. See fzsync_tm_end_race_a().
+ *
+ * The offset of the last race is in pair->delay_ns. This only needs
+ * one CPU. The delay bias can't be used and the timing profile is not
+ * saved.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_tm_run_a(struct fzsync_pair *pair)
+{
+	int rval;
+
+	if (!pair->tm) {
+		rval = fzsync_tm_setup(pair);
+		if (rval) {
+			fzsync_printf("Can't set up the timer: %s",
+				      strerror(rval));
+			fzsync_pair_cleanup(pair);
+			return 0;
+		}
+	}
+
+	if (fzsync_pair_decide_exit(pair)) {
+		fzsync_pair_cleanup(pair);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Marks the start of a race in timer mode and sets the timer
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_tm_run_a
+ */
+static inline void fzsync_tm_start_race_a(struct fzsync_pair *pair)
+{
+	long long start, offset, lat = pair->tm_latency.avg;
+	struct timespec now;
+
+	fzsync_tm_update(pair);
+
+	if (pair->tm_sample) {
+		pair->delay_ns = 0;
+		fzsync_time(&pair->a_start);
+		return;
+	}
+
+	offset = fzsync_pair_rand_time(pair);
+	pair->delay_ns = offset;
+
+	fzsync_time(&now);
+	start = fzsync_ts_ns(now) + FZSYNC_TM_LEAD + lat + MAX(-offset, 0LL);
+	fzsync_tm_arm(pair, start + offset - lat);
+	fzsync_wait_until(start, &pair->a_start);
+}
+
+/**
+ * Spin until the timer's signal handler has run
+ *
+ * @relates fzsync_pair
+ * @param last Set to the last time read before the handler had run
+ * @returns Non-zero if the handler ran within FZSYNC_EXIT_NS of the expiry
+ *
+ * The spin does not yield, so that thread A is running when the signal
+ * arrives. If the signal is lost, for example because the test blocked
+ * it, the timer is disarmed and the loop is not sampled.
+ */
+static inline int fzsync_tm_wait(struct fzsync_pair *pair,
+				 struct timespec *last)
+{
+	struct itimerspec its;
+	struct timespec now;
+
+	*last = pair->a_end;
+	for (;;) {
+		fzsync_time(&now);
+		if (fzsync_atomic_load(&pair->tm_fired))
+			return 1;
+		if (fzsync_ts_ns(now) - pair->tm_expiry > FZSYNC_EXIT_NS)
+			break;
+		*last = now;
+	}
+
+	memset(&its, 0, sizeof(its));
+	timer_settime(pair->tm_timer, 0, &its, NULL);
+	fzsync_printf("The timer signal was not handled within %dms of the expiry",
+		      FZSYNC_EXIT_NS / 1000000);
+
+	return 0;
+}
+
+/**
+ * Marks the end of a race in timer mode and waits for the handler
+ *
+ * @relates fzsync_pair
+ *
+ * While sampling, the timer is set to expire now and thread A spins on
+ * the clock until the handler has run. The latency is the time thread
+ * A kept running after the expiry. It is not the time until the handler
+ * starts, because on some systems, such as virtual machines, most of
+ * that time is spent with thread A already interrupted.
+ *
+ * @sa fzsync_tm_run_a
+ */
+static inline void fzsync_tm_end_race_a(struct fzsync_pair *pair)
+{
+	struct timespec last;
+
+	fzsync_time(&pair->a_end);
+
+	if (!pair->tm_sample) {
+		fzsync_tm_wait(pair, &last);
+	} else {
+		fzsync_tm_arm(pair, fzsync_ts_ns(pair->a_end));
+		if (fzsync_tm_wait(pair, &last)) {
+			fzsync_upd_stat(&pair->tm_latency, pair->avg_alpha,
+					MAX(fzsync_ts_ns(last) - pair->tm_expiry, 0LL));
+		}
+	}
+
+	if (pair->cs)
+		fzsync_cs_classify(pair);
+}
+
+/**
+ * Choose the priorities and change points of the next race
+ *
+ * @relates fzsync_pair
+ *
+ * One thread gets priority pct_depth + 1 and the other pct_depth. The
+ * change points are distinct steps chosen uniformly from one to the
+ * most steps seen in a race so far. At the i-th change point the
+ * running thread's priority drops to i, below both initial priorities.
+ */
+static void fzsync_pct_schedule(struct fzsync_pair *pair)
+{
+	int i, j, step, a_high, d = pair->pct_depth;
+	int k = pair->pct_steps = MAX(pair->pct_steps, pair->pct_step);
+
+	a_high = erand48(pair->rand_state) < 0.5;
+	pair->pct_prio[FZSYNC_UP_A] = d + a_high;
+	pair->pct_prio[FZSYNC_UP_B] = d + !a_high;
+
+	for (i = 0; i < d - 1; i++) {
+		do {
+			step = 1 + (int)(erand48(pair->rand_state) * MAX(k, 1));
+			for (j = 0; j < i && pair->pct_change[j] != step; j++)
+				;
+		} while (j < i && k >= d - 1);
+
+		pair->pct_change[i] = step;
+	}
+
+	pair->pct_step = 0;
+	pair->pct_done[FZSYNC_UP_A] = 0;
+	pair->pct_done[FZSYNC_UP_B] = 0;
+	fzsync_atomic_store(a_high ? FZSYNC_UP_A : FZSYNC_UP_B, &pair->up_turn);
+}
+
+/**
+ * Take a step and switch threads if the other has a higher priority
+ *
+ * @relates fzsync_pair
+ * @param self FZSYNC_UP_A or FZSYNC_UP_B
+ *
+ * Only the thread with the turn runs, so the step and priorities are
+ * never accessed by both threads at once.
+ */
+static inline void fzsync_pct_yield(struct fzsync_pair *pair, int self)
+{
+	int i, other = !self, step = ++pair->pct_step;
+
+	for (i = 0; i < pair->pct_depth - 1; i++) {
+		if (pair->pct_change[i] == step)
+			pair->pct_prio[self] = i + 1;
+	}
+
+	if (pair->pct_prio[other] < pair->pct_prio[self]
+	    || fzsync_atomic_load(&pair->pct_done[other]))
+		return;
+
+	fzsync_up_pass(pair, other);
+	fzsync_up_wait(pair, self, self == FZSYNC_UP_B ? &pair->exit : NULL);
+}
+
+/**
+ * Decide whether to continue running thread A in PCT mode
+ *
+ * @relates fzsync_pair
+ *
+ * For races in userspace, random delays are a blunt tool. The PCT
+ * (Probabilistic Concurrency Testing) mode instead only lets one thread
+ * run its race at a time and switches between them at yield points
+ * according to randomised priorities:
+ *
+ * while (fzsync_pct_run_a(&pair)) {
+ *	// Perform some setup which must happen before the race
+ *	fzsync_pct_start_race_a(&pair);
+ *	// Do something, calling fzsync_pct_yield_a() between steps
+ *	fzsync_pct_end_race_a(&pair);
+ * }
+ *
+ * Thread B uses the corresponding _b functions. Each yield is a step
+ * and the thread with the highest priority runs until it finishes its
+ * race or its priority drops at a change point.
+ * With k steps in a race, the chance of hitting a bug which needs a
+ * particular ordering of pct_depth steps is at least 1 / (2 k^(d - 1))
+ * in each race. k is learned from the previous races.
+ *
+ * The turn is passed with the same futex as in the uniprocessor mode.
+ * No delays are used and the statistics are not updated.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_pct_run_a(struct fzsync_pair *pair)
+{
+	pair->pct = 1;
+
+	return fzsync_run_a(pair);
+}
+
+/**
+ * Decide whether to continue running thread B in PCT mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pct_run_a
+ */
+static inline int fzsync_pct_run_b(struct fzsync_pair *pair)
+{
+	return fzsync_run_b(pair);
+}
+
+/**
+ * Marks the start of a race in thread A in PCT mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pct_run_a
+ */
+static inline void fzsync_pct_start_race_a(struct fzsync_pair *pair)
+{
+	fzsync_pct_schedule(pair);
+	fzsync_wait_a(pair);
+	fzsync_up_wait(pair, FZSYNC_UP_A, NULL);
+	fzsync_time(&pair->a_start);
+}
+
+/**
+ * A yield point in thread A's race in PCT mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pct_run_a
+ */
+static inline void fzsync_pct_yield_a(struct fzsync_pair *pair)
+{
+	fzsync_pct_yield(pair, FZSYNC_UP_A);
+}
+
+/**
+ * Marks the end of a race in thread A in PCT mode
+ *
+ * @relates fzsync_pair
+ *
+ * Hands the turn to thread B if it has not finished, then waits for it
+ * at the barrier.
+ *
+ * @sa fzsync_pct_run_a
+ */
+static inline void fzsync_pct_end_race_a(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->a_end);
+	fzsync_atomic_store(1, &pair->pct_done[FZSYNC_UP_A]);
+	if (!fzsync_atomic_load(&pair->pct_done[FZSYNC_UP_B]))
+		fzsync_up_pass(pair, FZSYNC_UP_B);
+
+	fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, NULL);
+}
+
+/**
+ * Marks the start of a race in thread B in PCT mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pct_run_a
+ */
+static inline void fzsync_pct_start_race_b(struct fzsync_pair *pair)
+{
+	fzsync_wait_b(pair);
+	fzsync_up_wait(pair, FZSYNC_UP_B, &pair->exit);
+	fzsync_time(&pair->b_start);
+}
+
+/**
+ * A yield point in thread B's race in PCT mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pct_run_a
+ */
+static inline void fzsync_pct_yield_b(struct fzsync_pair *pair)
+{
+	fzsync_pct_yield(pair, FZSYNC_UP_B);
+}
+
+/**
+ * Marks the end of a race in thread B in PCT mode
+ *
+ * @relates fzsync_pair
+ * @sa fzsync_pct_end_race_a
+ */
+static inline void fzsync_pct_end_race_b(struct fzsync_pair *pair)
+{
+	fzsync_time(&pair->b_end);
+	fzsync_atomic_store(1, &pair->pct_done[FZSYNC_UP_B]);
+	if (!fzsync_atomic_load(&pair->pct_done[FZSYNC_UP_A]))
+		fzsync_up_pass(pair, FZSYNC_UP_A);
+
+	fzsync_pair_wait_exit(&pair->b_cntr, &pair->a_cntr, NULL,
+			      &pair->exit);
+}
+
+/**
+ * Add some amount to the delay bias
+ *
+ * @relates fzsync_pair
+ * @param change The amount to add, can be negative
+ *
+ * A positive change delays thread B and a negative one delays thread
+ * A.
+ *
+ * It is intended to be used in tests where the time taken by syscall A and/or
+ * B are significantly affected by their chronological order. To the extent
+ * that the delay range will not include the correct values if too many of the
+ * initial samples are taken when the syscalls (or operations within the
+ * syscalls) happen in the wrong order.
+ *
+ * An example of this is cve/cve-2016-7117.c where a call to close() is racing
+ * with a call to recvmmsg(). If close() happens before recvmmsg() has chance
+ * to check if the file descriptor is open then recvmmsg() completes very
+ * quickly. If the call to close() happens once recvmmsg() has already checked
+ * the descriptor it takes much longer. The sample where recvmmsg() completes
+ * quickly is essentially invalid for our purposes. The test uses the simple
+ * heuristic of whether recvmmsg() returns EBADF, to decide if it should call
+ * fzsync_pair_add_bias() to further delay syscall B.
+ *
+ * The bias is saved in the timing profile. When the pair was
+ * warm-started from a profile the saved bias is used as is, otherwise
+ * it would grow each time the profile is verified.
+ *
+ * The bias can't be used in time-triggered or timer mode because no
+ * spins are counted to convert it to a time.
+ */
+static inline void fzsync_pair_add_bias(struct fzsync_pair *pair, int change)
+{
+	assert(!pair->tt && !pair->tm);
+
+	if (pair->sampling > 0 && !pair->profile_loaded)
+		pair->delay_bias += change;
+}
+
+/**
+ * Count an outcome of the current iteration
+ *
+ * @relates fzsync_pair
+ * @param outcome Usually FZSYNC_HIT when the race has been reproduced
+ *
+ * Call from thread A. The counts are reset by fzsync_pair_reset(),
+ * unless it resumes from a checkpoint, and printed by
+ * fzsync_pair_info().
+ */
+static inline void fzsync_pair_count(struct fzsync_pair *pair,
+				     enum fzsync_outcome outcome)
+{
+	fzsync_counter_inc(pair->outcomes + outcome);
+}
+
+/** The maximum number of threads in a fzsync_group */
+#define FZSYNC_GROUP_MAX 8
+/** The maximum number of rounds in the group barrier, log2(FZSYNC_GROUP_MAX) */
+#define FZSYNC_GROUP_ROUNDS 3
+
+struct fzsync_group;
+
+/**
+ * The state of one thread in a fzsync_group
+ *
+ * Each member is on its own cache line(s). Only the barrier flags are
+ * written by other threads.
+ */
+struct fzsync_member {
+	/** Internal; Barrier flags, each written by one other member */
+	int flags[FZSYNC_GROUP_ROUNDS];
+	/** Internal; The number of barriers this member has entered */
+	int episode;
+	/** Internal; The delay before the race in nanoseconds */
+	long long delay_ns;
+	/** Internal; Start time */
+	struct timespec start;
+	/** Internal; End time */
+	struct timespec end;
+	/** Internal; Avg. difference between start and member 0's start */
+	struct fzsync_stat diff_s;
+	/** Internal; Avg. difference between start and end */
+	struct fzsync_stat diff_t;
+	/** This member's index in the group, member 0 is the main thread */
+	int id;
+	/** The group this member belongs to */
+	struct fzsync_group *group;
+	/** Internal; The thread running this member or 0 */
+	pthread_t thread;
+	/** Internal; The function and argument passed to the thread */
+	struct fzsync_run_thread run;
+} __attribute__((aligned(64)));
+
+/**
+ * The state of an N way race
+ *
+ * This is the equivalent of fzsync_pair for more than two threads. The
+ * main thread is member 0, which plays the role of thread A. It makes
+ * the exit decisions and calculates the delays. The other members
+ * play the role of thread B.
+ *
+ * The configurable fields have the same meaning and defaults as their
+ * fzsync_pair counterparts.
+ */
+struct fzsync_group {
+	/** The number of threads in the race including the main thread */
+	int n;
+	float avg_alpha;
+	int min_samples;
+	float max_dev_ratio;
+	float exec_time;
+	int exec_loops;
+
+	/** Internal; The number of rounds in the barrier */
+	int rounds;
+	/** Internal; The number of samples left or the sampling state */
+	int sampling;
+	/** Internal; Used by fzsync_group_run() */
+	int exit;
+	/** Internal; The current loop index */
+	int exec_loop;
+	/** Internal; The test time remaining on fzsync_group_reset() */
+	struct timespec exec_time_start;
+	/** Internal; The state of the delay's random number generator */
+	unsigned short rand_state[3];
+	/** Internal; The per thread state */
+	struct fzsync_member members[FZSYNC_GROUP_MAX];
+};
+
+#define CHK(param, low, hi, def) do {					\
+		group->param = (group->param ? group->param : def);	\
+		assert(group->param >= low);				\
+		assert(group->param <= hi);				\
+	} while (0)
+/**
+ * Ensures that any group parameters are properly set
+ *
+ * @relates fzsync_group
+ * @sa fzsync_pair_init()
+ */
+static inline void fzsync_group_init(struct fzsync_group *group)
+{
+	CHK(n, 2, FZSYNC_GROUP_MAX, 3);
+	CHK(avg_alpha, FLT_MIN, 1, 0.25);
+	CHK(min_samples, 20, INT_MAX, 1024);
+	CHK(max_dev_ratio, FLT_MIN, 1, 0.1);
+	CHK(exec_time, 1, FLT_MAX, 150);
+	CHK(exec_loops, 20, INT_MAX, 3000000);
+}
+#undef CHK
+
+/**
+ * Wait for all the other members of the group
+ *
+ * @relates fzsync_group
+ * @param id The calling thread's member index
+ *
+ * A dissemination barrier: in round r, member i signals member
+ * i + 2^r and waits for member i - 2^r. So each member waits on its
+ * own flags and there are only log2(n) rounds, instead of all members
+ * contending for a single counter. The flags are set to the episode
+ * number, which only increases, so they never need resetting.
+ */
+static inline void fzsync_group_wait(struct fzsync_group *group, int id)
+{
+	struct fzsync_member *self = group->members + id;
+	struct fzsync_member *partner;
+	int r, episode = ++self->episode;
+
+	for (r = 0; r < group->rounds; r++) {
+		partner = group->members + (id + (1 << r)) % group->n;
+		fzsync_atomic_store(episode, partner->flags + r);
+
+		while (fzsync_atomic_load(self->flags + r) < episode
+		       && !fzsync_exiting(id ? &group->exit : NULL))
+			fzsync_yield();
+	}
+}
+
+/**
+ * Exit and join the group's threads if necessary
+ *
+ * @relates fzsync_group
+ * @sa fzsync_pair_cleanup()
+ */
+static void fzsync_group_cleanup(struct fzsync_group *group)
+{
+	struct fzsync_member *m;
+	int i, revoke = 0;
+
+	for (i = 1; i < FZSYNC_GROUP_MAX; i++)
+		revoke |= group->members[i].thread && !group->exit;
+
+	/* Revoke the threads if member 0 hits an accidental break */
+	if (revoke)
+		fzsync_atomic_store(1, &group->exit);
+
+	for (i = 1; i < FZSYNC_GROUP_MAX; i++) {
+		m = group->members + i;
+		if (!m->thread)
+			continue;
+
+		if (revoke && !fzsync_wait_done(&m->run.done)) {
+			fzsync_printf("Member %d did not exit, cancelling it", i);
+			pthread_cancel(m->thread);
+		}
+		pthread_join(m->thread, NULL);
+		m->thread = 0;
+	}
+}
+
+/**
+ * Reset or initialise a group and start its threads
+ *
+ * @relates fzsync_group
+ * @param run The function run by members 1 to n - 1. It is passed a
+ *            pointer to the thread's fzsync_member.
+ * @returns The result of pthread_create, clock_gettime or zero
+ *
+ * @sa fzsync_pair_reset()
+ */
+static inline int fzsync_group_reset(struct fzsync_group *group,
+				     void *(*run)(void *))
+{
+	struct fzsync_member *m;
+	int i, rval;
+
+	fzsync_group_cleanup(group);
+
+	for (group->rounds = 0; (1 << group->rounds) < group->n;)
+		group->rounds++;
+
+	for (i = 0; i < FZSYNC_GROUP_MAX; i++) {
+		m = group->members + i;
+		memset(m->flags, 0, sizeof(m->flags));
+		m->episode = 0;
+		m->delay_ns = 0;
+		fzsync_init_stat(&m->diff_s);
+		fzsync_init_stat(&m->diff_t);
+		m->id = i;
+		m->group = group;
+	}
+
+	fzsync_rand_init(group->rand_state);
+
+	group->sampling = group->min_samples;
+	group->exec_loop = 0;
+	group->exit = 0;
+
+	for (i = 1; i < group->n; i++) {
+		m = group->members + i;
+		m->run.func = run;
+		m->run.arg = m;
+		m->run.done = 0;
+		rval = pthread_create(&m->thread, 0,
+				      fzsync_thread_wrapper, &m->run);
+		if (rval)
+			return rval;
+	}
+
+	return fzsync_time(&group->exec_time_start);
+}
+
+/**
+ * Print some synchronisation statistics for each member
+ *
+ * @relates fzsync_group
+ */
+static void fzsync_group_info(struct fzsync_group *group)
+{
+	char name[48];
+	int i;
+
+	fzsync_printf("loop = %d", group->exec_loop);
+	for (i = 0; i < group->n; i++) {
+		snprintf(name, sizeof(name), "start_%d - start_0", i);
+		fzsync_stat_info(group->members[i].diff_s, "ns", name);
+		snprintf(name, sizeof(name), "end_%d - start_%d", i, i);
+		fzsync_stat_info(group->members[i].diff_t, "ns", name);
+	}
+}
+
+/**
+ * Calculate the statistics and the delay for each member
+ *
+ * @relates fzsync_group
+ *
+ * The same as fzsync_pair_update(), but with n dimensions. Once the
+ * window lengths are stable, each member i > 0 is given a random start
+ * time relative to member 0 in the range [-end_i + start_i, end_0 -
+ * start_0]. So any point in member i's window can be aligned with any
+ * point in member 0's window and, because each member is independent,
+ * any combination of points in all of the windows can be
+ * aligned. The start time is corrected by the average difference
+ * between the member's start and member 0's start without a delay.
+ * Then all the delays are shifted so the smallest is zero.
+ *
+ * Unlike the pair, the delays are in nanoseconds and are waited out on
+ * the clock. Only the window lengths are checked against
+ * max_dev_ratio, because the start differences are usually close to
+ * zero.
+ */
+static void fzsync_group_update(struct fzsync_group *group)
+{
+	struct fzsync_member *m, *m0 = group->members;
+	float alpha = group->avg_alpha;
+	long long min_delay = 0;
+	int i, over_max_dev = 0;
+
+	for (i = 0; i < group->n; i++) {
+		m = group->members + i;
+		over_max_dev |= m->diff_t.dev_ratio > group->max_dev_ratio;
+		m->delay_ns = 0;
+	}
+
+	if (group->sampling > 0 || over_max_dev) {
+		for (i = 0; i < group->n; i++) {
+			m = group->members + i;
+			fzsync_upd_diff_stat(&m->diff_s, alpha, m->start, m0->start);
+			fzsync_upd_diff_stat(&m->diff_t, alpha, m->end, m->start);
+		}
+
+		if (group->sampling > 0 && --group->sampling == 0) {
+			fzsync_printf("Minimum sampling period ended");
+			fzsync_group_info(group);
+		}
+
+		return;
+	}
+
+	for (i = 1; i < group->n; i++) {
+		m = group->members + i;
+		m->delay_ns = erand48(group->rand_state)
+			* (m0->diff_t.avg + m->diff_t.avg)
+			- m->diff_t.avg - m->diff_s.avg;
+		min_delay = MIN(min_delay, m->delay_ns);
+	}
+
+	for (i = 0; i < group->n; i++)
+		group->members[i].delay_ns -= min_delay;
+
+	if (!group->sampling) {
+		fzsync_printf("Reached deviation ratios < %.2f, introducing randomness",
+			      group->max_dev_ratio);
+		fzsync_group_info(group);
+		group->sampling = -1;
+	}
+}
+
+/**
+ * Decide whether to continue running a member's loop
+ *
+ * @relates fzsync_group
+ * @param id The calling thread's member index
+ *
+ * Member 0 checks the time and loop limits. The other members find out
+ * its decision after the barrier.
+ *
+ * @return True to continue and false to break.
+ */
+static inline int fzsync_group_run(struct fzsync_group *group, int id)
+{
+	int exit = 0;
+
+	if (!id) {
+		if (!fzsync_time_remaining(group->exec_time,
+					   group->exec_time_start)) {
+			fzsync_printf("Exceeded execution time, requesting exit");
+			exit = 1;
+		}
+
+		if (++group->exec_loop > group->exec_loops) {
+			fzsync_printf("Exceeded execution loops, requesting exit");
+			exit = 1;
+		}
+
+		if (group->sampling > 0 && group->exec_time * SAMPLING_SLICE
+		    > fzsync_time_remaining(group->exec_time,
+					    group->exec_time_start)) {
+			fzsync_printf("Stopped sampling at %d (out of %d) samples",
+				      group->exec_loop, group->min_samples);
+			group->sampling = 0;
+		}
+
+		fzsync_atomic_store(exit, &group->exit);
+	}
+
+	fzsync_group_wait(group, id);
+
+	if (!fzsync_atomic_load(&group->exit))
+		return 1;
+
+	if (!id)
+		fzsync_group_cleanup(group);
+
+	return 0;
+}
+
+/**
+ * Marks the start of a race region in a member
+ *
+ * @relates fzsync_group
+ * @param id The calling thread's member index
+ *
+ * @sa fzsync_start_race_a()
+ */
+static inline void fzsync_group_start_race(struct fzsync_group *group,
+					   int id)
+{
+	struct fzsync_member *self = group->members + id;
+
+	if (!id)
+		fzsync_group_update(group);
+
+	fzsync_group_wait(group, id);
+
+	fzsync_time(&self->start);
+	if (self->delay_ns > 0) {
+		fzsync_wait_until(fzsync_ts_ns(self->start) + self->delay_ns,
+				  &self->start);
 	}
+}
 
-	pair->spins = 0;
+/**
+ * Marks the end of a race region in a member
+ *
+ * @relates fzsync_group
+ * @param id The calling thread's member index
+ */
+static inline void fzsync_group_end_race(struct fzsync_group *group, int id)
+{
+	fzsync_time(&group->members[id].end);
+	fzsync_group_wait(group, id);
 }
 
+/** The maximum number of replicas in a fzsync_pool */
+#define FZSYNC_POOL_MAX 256
+
+struct fzsync_pool;
+
 /**
- * Wait for the other thread
+ * One pair of racing threads in a fzsync_pool
  *
- * @relates fzsync_pair
- * @param our_cntr The counter for the thread we are on
- * @param other_cntr The counter for the thread we are synchronising with
- * @param spins A pointer to the spin counter or NULL
+ * Passed as the argument to both thread functions given to
+ * fzsync_pool_run().
+ */
+struct fzsync_replica {
+	/** The replica's pair, thread A is a thread created by the pool */
+	struct fzsync_pair pair;
+	/** The replica's index */
+	int id;
+	/** The pool this replica belongs to */
+	struct fzsync_pool *pool;
+	/** The CPUs which threads A and B are pinned to or -1 */
+	int cpu_a;
+	int cpu_b;
+	/** Internal; Thread A */
+	pthread_t thread_a;
+	/** Internal; The result of starting the replica */
+	int rval;
+	/** Internal; Loops per second of the replica's last run */
+	float rate;
+} __attribute__((aligned(64)));
+
+/**
+ * Independent replicas of a race running in parallel
  *
- * Used by fzsync_pair_wait_a(), fzsync_pair_wait_b(),
- * fzsync_start_race_a(), etc. If the calling thread is ahead of the other
- * thread, then it will spin wait. Unlike pthread_barrier_wait it will never
- * use futex and can count the number of spins spent waiting.
+ * A race which is hit once in a million iterations is hit about K times
+ * more often by K pairs of threads on K pairs of CPUs. Each replica has
+ * its own fzsync_pair, random number generator state and threads. The
+ * pool aggregates the loop and outcome counts.
  *
- * @return A non-zero value if the thread should continue otherwise the
- * calling thread should exit.
+ * Set pair to the configuration of each replica's pair before calling
+ * fzsync_pool_init().
  */
-static inline void fzsync_pair_wait(int *our_cntr,
-					int *other_cntr,
-					int *spins)
+struct fzsync_pool {
+	/**
+	 * The number of replicas
+	 *
+	 * Defaults to half the CPUs the process may run on.
+	 */
+	int n;
+	/** Don't pin the threads to CPUs */
+	int no_pin;
+	/** The configuration copied into each replica's pair */
+	struct fzsync_pair pair;
+
+	/** Internal; The thread A function of the current run */
+	void *(*run_a)(void *);
+	/** Internal; The thread B function of the current run */
+	void *(*run_b)(void *);
+	/** Internal; The replicas of the last run */
+	struct fzsync_replica *replicas;
+	/** Internal; The sum of the replicas' loop counts */
+	long loops;
+	/** Internal; The sum of the replicas' outcome counters */
+	long outcomes[FZSYNC_MAX_OUTCOMES];
+	/** Internal; The sum of the replicas' loop rates */
+	float rate;
+};
+
+/**
+ * Ensures that any pool parameters are properly set
+ *
+ * @relates fzsync_pool
+ * @sa fzsync_pair_init()
+ */
+static inline void fzsync_pool_init(struct fzsync_pool *pool)
 {
-	if (fzsync_atomic_inc(other_cntr) == INT_MAX) {
-		/*
-		 * We are about to break the invariant that the thread with
-		 * the lowest count is in front of the other. So we must wait
-		 * here to ensure the other thread has at least reached the
-		 * line above before doing that. If we are in rear position
-		 * then our counter may already have been set to zero.
-		 */
-		while (fzsync_atomic_load(our_cntr) > 0
-		       && fzsync_atomic_load(our_cntr) < INT_MAX) {
-			if (spins)
-				(*spins)++;
+	int cpus[FZSYNC_POOL_MAX];
 
-			fzsync_yield();
-		}
+	if (!pool->n)
+		pool->n = MAX(fzsync_cpus(cpus, FZSYNC_POOL_MAX) / 2, 1);
 
-		fzsync_atomic_store(0, other_cntr);
-		/*
-		 * Once both counters have been set to zero the invariant
-		 * is restored and we can continue.
-		 */
-		while (fzsync_atomic_load(our_cntr) > 1)
-			fzsync_yield();
-	} else {
-		/*
-		 * If our counter is less than the other thread's we are ahead
-		 * of it and need to wait.
-		 */
-		while (fzsync_atomic_load(our_cntr) < fzsync_atomic_load(other_cntr)) {
-			if (spins)
-				(*spins)++;
+	assert(pool->n >= 1);
+	assert(pool->n <= FZSYNC_POOL_MAX);
+	assert(!pool->pair.checkpoint_path);
+	assert(!pool->pair.placement && !pool->pair.placement_loops);
+	assert(!pool->pair.clone_b);
 
-			fzsync_yield();
-		}
-	}
+	fzsync_pair_init(&pool->pair);
 }
 
 /**
- * Wait in thread A
+ * Free the replicas of the last run
  *
- * @relates fzsync_pair
- * @sa fzsync_pair_wait
+ * @relates fzsync_pool
  */
-static inline void fzsync_wait_a(struct fzsync_pair *pair)
+static void fzsync_pool_cleanup(struct fzsync_pool *pool)
 {
-	fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, NULL);
+	free(pool->replicas);
+	pool->replicas = NULL;
 }
 
 /**
- * Wait in thread B
+ * The body of each replica's thread A
  *
- * @relates fzsync_pair
- * @sa fzsync_pair_wait
+ * Starts thread B, pins both threads and runs the pool's thread A
+ * function.
  */
-static inline void fzsync_wait_b(struct fzsync_pair *pair)
+static void *fzsync_replica_main(void *arg)
 {
-	fzsync_pair_wait(&pair->b_cntr, &pair->a_cntr, NULL);
+	struct fzsync_replica *r = arg;
+	struct fzsync_pair *pair = &r->pair;
+	struct timespec start, end;
+
+	fzsync_pin(pthread_self(), r->cpu_a);
+
+	r->rval = fzsync_pair_reset_arg(pair, r->pool->run_b, r);
+	if (r->rval)
+		return NULL;
+
+	fzsync_pin(pair->thread_b, r->cpu_b);
+
+	fzsync_time(&start);
+	r->pool->run_a(r);
+	fzsync_time(&end);
+	fzsync_pair_cleanup(pair);
+
+	r->rate = pair->exec_loop / (fzsync_diff_ns(end, start) * 1e-9f);
+
+	return NULL;
 }
 
 /**
- * Decide whether to continue running thread A
+ * Print the replicas' loop rates and the aggregated counts
  *
- * @relates fzsync_pair
+ * @relates fzsync_pool
+ */
+static void fzsync_pool_info(struct fzsync_pool *pool)
+{
+	struct fzsync_replica *r;
+	int i;
+
+	for (i = 0; i < pool->n; i++) {
+		r = pool->replicas + i;
+		fzsync_printf("replica %d: cpus = %d,%d, loop = %d, %.0f/s, hits = %ld",
+			      i, r->cpu_a, r->cpu_b, r->pair.exec_loop, r->rate,
+			      r->pair.outcomes[FZSYNC_HIT]);
+	}
+
+	fzsync_printf("pool: replicas = %d, loops = %ld, %.0f/s, hits = %ld",
+		      pool->n, pool->loops, pool->rate,
+		      pool->outcomes[FZSYNC_HIT]);
+}
+
+/**
+ * Run each replica's threads until they exit
  *
- * Checks some values and decides whether it is time to break the loop of
- * thread A.
+ * @relates fzsync_pool
+ * @param run_a The function defining thread A
+ * @param run_b The function defining thread B
+ * @returns The first error starting a replica or zero
  *
- * @return True to continue and false to break.
- * @sa fzsync_run_a
+ * Both functions receive the replica as their argument and use its
+ * pair in the usual way:
+ *
+ * static void *run_a(void *arg)
+ * {
+ *	struct fzsync_replica *r = arg;
+ *
+ *	while (fzsync_run_a(&r->pair)) {
+ *		fzsync_start_race_a(&r->pair);
+ *		// Do some dodgy syscall
+ *		fzsync_end_race_a(&r->pair);
+ *	}
+ *
+ *	return NULL;
+ * }
+ *
+ * If there are at least twice as many CPUs as replicas, then replica i
+ * is pinned to the CPUs 2i and 2i + 1 of those the process may use.
+ * The random number generator of replica i is seeded with that of
+ * pool->pair, or the default seed if it is zero, with i mixed in. So
+ * replica zero continues the caller's sequence and the others differ.
+ * The replicas' loop rates and the totals are printed at the end.
+ *
+ * Only replica zero uses the timing profile. Checkpoints are not
+ * supported.
  */
-static inline int fzsync_run_a(struct fzsync_pair *pair)
+static inline int fzsync_pool_run(struct fzsync_pool *pool,
+				  void *(*run_a)(void *),
+				  void *(*run_b)(void *))
 {
-	int exit = 0;
-	float rem = fzsync_timeout_remaining(pair);
+	int cpus[FZSYNC_POOL_MAX], ncpus, pin, started, i, j, rval = 0;
+	struct fzsync_replica *r;
+	unsigned short seed[3];
 
-	if ((pair->exec_time * SAMPLING_SLICE > rem)
-		&& (pair->sampling > 0)) {
-		fzsync_printf("Stopped sampling at %d (out of %d) samples, "
-			      "sampling time reached 50%% of the total time limit",
-			      pair->exec_loop, pair->min_samples);
-		pair->sampling = 0;
-		fzsync_pair_info(pair);
-	}
+	ncpus = fzsync_cpus(cpus, FZSYNC_POOL_MAX);
+	pin = !pool->no_pin && ncpus >= 2 * pool->n;
 
-	if (!rem) {
-		fzsync_printf("Exceeded execution time, requesting exit");
-		exit = 1;
-	}
+	fzsync_pool_cleanup(pool);
+	pool->replicas = aligned_alloc(64, pool->n * sizeof(*pool->replicas));
+	if (!pool->replicas)
+		return ENOMEM;
 
-	if (++pair->exec_loop > pair->exec_loops) {
-		fzsync_printf("Exceeded execution loops, requesting exit");
-		exit = 1;
+	pool->run_a = run_a;
+	pool->run_b = run_b;
+
+	memcpy(seed, pool->pair.rand_state, sizeof(seed));
+	fzsync_rand_init(seed);
+
+	for (i = 0; i < pool->n; i++) {
+		r = pool->replicas + i;
+		memset(r, 0, sizeof(*r));
+		r->pair = pool->pair;
+		r->pair.rand_state[0] = seed[0];
+		r->pair.rand_state[1] = seed[1] ^ i;
+		r->pair.rand_state[2] = seed[2] ^ (i >> 16);
+		if (i)
+			r->pair.profile_path = NULL;
+		r->id = i;
+		r->pool = pool;
+		r->cpu_a = pin ? cpus[2 * i] : -1;
+		r->cpu_b = pin ? cpus[2 * i + 1] : -1;
+
+		rval = pthread_create(&r->thread_a, 0, fzsync_replica_main, r);
+		if (rval)
+			break;
 	}
 
-	fzsync_atomic_store(exit, &pair->exit);
-	fzsync_wait_a(pair);
+	started = i;
+	pool->loops = 0;
+	pool->rate = 0;
+	memset(pool->outcomes, 0, sizeof(pool->outcomes));
 
-	if (exit) {
-		fzsync_pair_cleanup(pair);
-		return 0;
+	for (i = 0; i < started; i++) {
+		r = pool->replicas + i;
+		pthread_join(r->thread_a, NULL);
+
+		if (r->rval && !rval)
+			rval = r->rval;
+
+		pool->loops += r->pair.exec_loop;
+		pool->rate += r->rate;
+		for (j = 0; j < FZSYNC_MAX_OUTCOMES; j++)
+			pool->outcomes[j] += r->pair.outcomes[j];
 	}
 
-	return 1;
+	if (started)
+		fzsync_pool_info(pool);
+
+	return rval;
 }
 
+/** The maximum number of scheduling choices in one explored interleaving */
+#define FZSYNC_EXPLORE_MAX_CHOICES 4096
+/** The stack size of each fzsync_explore coroutine */
+#define FZSYNC_EXPLORE_STACK (1 << 16)
+
 /**
- * Decide whether to continue running thread B
+ * A systematic explorer of the interleavings of a userspace race model
  *
- * @relates fzsync_pair
- * @sa fzsync_run_a
+ * Race models, such as the windows in the basic and multi tests, are
+ * ordinary code with explicit steps. Instead of running thread A and B
+ * on real threads with random delays, the explorer runs them as
+ * coroutines on the calling thread and switches between them at
+ * fzsync_explore_yield(). Each call to fzsync_explore_run() runs one
+ * interleaving, then backtracks to the deepest choice with an
+ * untried alternative (a depth first search).
+ *
+ * Switching away from a coroutine which could continue is a
+ * preemption. Most races need few preemptions, so the search can be
+ * bounded by the number of preemptions in each interleaving. With a
+ * bound of p and k yields there are O(k^p) interleavings instead of
+ * exponentially many.
+ *
+ * The model must be deterministic, given the order of the steps, and
+ * must be reset before each run.
  */
-static inline int fzsync_run_b(struct fzsync_pair *pair)
+struct fzsync_explore {
+	/** The maximum number of preemptions in each interleaving or 0 */
+	int preemptions;
+
+	/** The number of interleavings run since fzsync_explore_reset() */
+	long long interleavings;
+	/** The most scheduling choices in one interleaving */
+	int max_choices;
+
+	/** Internal; The functions run by coroutines A and B */
+	void (*run[2])(void *);
+	/** Internal; The argument passed to run */
+	void *arg;
+	/** Internal; The context of the caller of fzsync_explore_run() */
+	ucontext_t main;
+	/** Internal; The contexts of coroutines A and B */
+	ucontext_t co[2];
+	/** Internal; The stacks of coroutines A and B */
+	char *stack[2];
+	/** Internal; The running coroutine */
+	int cur;
+	/** Internal; Whether each coroutine has returned */
+	int done[2];
+	/** Internal; The preemptions in the current interleaving */
+	int used;
+	/** Internal; The choices made in the current interleaving */
+	int choice;
+	/** Internal; The number of recorded choices to replay */
+	int replay;
+	/** Internal; The option taken at each choice, zero is the default */
+	unsigned char taken[FZSYNC_EXPLORE_MAX_CHOICES];
+	/** Internal; The number of options at each choice */
+	unsigned char options[FZSYNC_EXPLORE_MAX_CHOICES];
+	/** Internal; The start time of the exploration */
+	struct timespec start;
+};
+
+/** The explorer whose coroutines are running on this thread */
+static __thread struct fzsync_explore *fzsync_explore_cur;
+
+/**
+ * Free the coroutine stacks
+ *
+ * @relates fzsync_explore
+ */
+static inline void fzsync_explore_cleanup(struct fzsync_explore *ex)
 {
-	fzsync_wait_b(pair);
-	return !fzsync_atomic_load(&pair->exit);
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		free(ex->stack[i]);
+		ex->stack[i] = NULL;
+	}
 }
 
 /**
- * Marks the start of a race region in thread A
- *
- * @relates fzsync_pair
- *
- * This should be placed just before performing whatever action can cause a
- * race condition. Usually it is placed just before a syscall and
- * fzsync_end_race_a() is placed just afterwards.
+ * Reset or initialise the explorer and allocate the coroutine stacks
  *
- * A corresponding call to fzsync_start_race_b() should be made in thread
- * B.
+ * @relates fzsync_explore
+ * @returns Zero or ENOMEM
+ */
+static inline int fzsync_explore_reset(struct fzsync_explore *ex)
+{
+	int i;
+
+	assert(ex->preemptions >= 0);
+
+	for (i = 0; i < 2; i++) {
+		if (!ex->stack[i])
+			ex->stack[i] = malloc(FZSYNC_EXPLORE_STACK);
+		if (!ex->stack[i])
+			return ENOMEM;
+	}
+
+	ex->interleavings = 0;
+	ex->max_choices = 0;
+	ex->replay = 0;
+
+	return fzsync_time(&ex->start);
+}
+
+/**
+ * Take the next option at a choice
  *
- * @return A non-zero value if the calling thread should continue to loop. If
- * it returns zero then fzsync_exit() has been called and you must exit
- * the thread.
+ * @relates fzsync_explore
+ * @param options The number of options available, one means no choice
+ * @returns The index of the option, zero is the default
  *
- * @sa fzsync_pair_update
+ * Recorded choices are replayed to reach the next unexplored branch,
+ * after that the default is taken and recorded.
  */
-static inline void fzsync_start_race_a(struct fzsync_pair *pair)
+static int fzsync_explore_choose(struct fzsync_explore *ex, int options)
 {
-	volatile int delay;
+	int i = ex->choice;
 
-	fzsync_pair_update(pair);
+	if (options < 2)
+		return 0;
 
-	fzsync_wait_a(pair);
+	assert(i < FZSYNC_EXPLORE_MAX_CHOICES);
+	ex->choice++;
 
-	delay = pair->delay;
-	while (delay < 0)
-		delay++;
+	if (i < ex->replay)
+		return ex->taken[i];
 
-	fzsync_time(&pair->a_start);
+	ex->taken[i] = 0;
+	ex->options[i] = options;
+
+	return 0;
 }
 
 /**
- * Marks the end of a race region in thread A
+ * Find the deepest choice with an untried option
  *
- * @relates fzsync_pair
- * @sa fzsync_start_race_a
+ * @relates fzsync_explore
+ * @returns Zero when all the interleavings have been run
  */
-static inline void fzsync_end_race_a(struct fzsync_pair *pair)
+static int fzsync_explore_backtrack(struct fzsync_explore *ex)
 {
-	fzsync_time(&pair->a_end);
-	fzsync_pair_wait(&pair->a_cntr, &pair->b_cntr, &pair->spins);
+	int i;
+
+	for (i = ex->choice - 1; i >= 0; i--) {
+		if (ex->taken[i] + 1 < ex->options[i]) {
+			ex->taken[i]++;
+			ex->replay = i + 1;
+			return 1;
+		}
+	}
+
+	ex->replay = 0;
+
+	return 0;
 }
 
 /**
- * Marks the start of a race region in thread B
+ * The entry point of both coroutines
  *
- * @relates fzsync_pair
- * @sa fzsync_start_race_a
+ * When a coroutine returns, the other one runs to completion. When
+ * both have returned, control goes back to fzsync_explore_run().
  */
-static inline void fzsync_start_race_b(struct fzsync_pair *pair)
+static void fzsync_explore_main(void)
 {
-	volatile int delay;
+	struct fzsync_explore *ex = fzsync_explore_cur;
+	int self = ex->cur;
 
-	fzsync_wait_b(pair);
+	ex->run[self](ex->arg);
+	ex->done[self] = 1;
 
-	delay = pair->delay;
-	while (delay > 0)
-		delay--;
+	if (!ex->done[!self]) {
+		ex->cur = !self;
+		setcontext(ex->co + !self);
+	}
 
-	fzsync_time(&pair->b_start);
+	setcontext(&ex->main);
 }
 
 /**
- * Marks the end of a race region in thread B
+ * A step boundary in the race model
  *
- * @relates fzsync_pair
- * @sa fzsync_start_race_a
+ * @relates fzsync_explore
+ *
+ * Call from either coroutine. Either continues the running coroutine
+ * or, if the preemption bound allows it, switches to the other.
  */
-static inline void fzsync_end_race_b(struct fzsync_pair *pair)
+static inline void fzsync_explore_yield(struct fzsync_explore *ex)
 {
-	fzsync_time(&pair->b_end);
-	fzsync_pair_wait(&pair->b_cntr, &pair->a_cntr, &pair->spins);
+	int self = ex->cur;
+	int can_preempt = !ex->done[!self]
+		&& (!ex->preemptions || ex->used < ex->preemptions);
+
+	if (!fzsync_explore_choose(ex, 1 + can_preempt))
+		return;
+
+	ex->used++;
+	ex->cur = !self;
+	swapcontext(ex->co + self, ex->co + !self);
 }
 
 /**
- * Add some amount to the delay bias
+ * Run the next interleaving of a race model
  *
- * @relates fzsync_pair
- * @param change The amount to add, can be negative
+ * @relates fzsync_explore
+ * @param run_a The function defining coroutine A
+ * @param run_b The function defining coroutine B
+ * @param arg The argument passed to run_a and run_b
+ * @returns Zero after the last interleaving, otherwise one
  *
- * A positive change delays thread B and a negative one delays thread
- * A.
+ * Which coroutine runs first is a free choice, not a preemption. A
+ * typical use looks like:
  *
- * It is intended to be used in tests where the time taken by syscall A and/or
- * B are significantly affected by their chronological order. To the extent
- * that the delay range will not include the correct values if too many of the
- * initial samples are taken when the syscalls (or operations within the
- * syscalls) happen in the wrong order.
+ * fzsync_explore_reset(&ex);
+ * do {
+ *	// Reset the model
+ *	more = fzsync_explore_run(&ex, race_a, race_b, &model);
+ *	// Check the model's state
+ * } while (more);
+ */
+static inline int fzsync_explore_run(struct fzsync_explore *ex,
+				     void (*run_a)(void *),
+				     void (*run_b)(void *),
+				     void *arg)
+{
+	int i;
+
+	ex->run[0] = run_a;
+	ex->run[1] = run_b;
+	ex->arg = arg;
+	ex->choice = 0;
+	ex->used = 0;
+
+	for (i = 0; i < 2; i++) {
+		ex->done[i] = 0;
+		getcontext(ex->co + i);
+		ex->co[i].uc_stack.ss_sp = ex->stack[i];
+		ex->co[i].uc_stack.ss_size = FZSYNC_EXPLORE_STACK;
+		ex->co[i].uc_link = &ex->main;
+		makecontext(ex->co + i, fzsync_explore_main, 0);
+	}
+
+	fzsync_explore_cur = ex;
+	ex->cur = fzsync_explore_choose(ex, 2);
+	swapcontext(&ex->main, ex->co + ex->cur);
+	fzsync_explore_cur = NULL;
+
+	ex->interleavings++;
+	ex->max_choices = MAX(ex->max_choices, ex->choice);
+
+	return fzsync_explore_backtrack(ex);
+}
+
+/**
+ * Print the number and rate of the interleavings run
  *
- * An example of this is cve/cve-2016-7117.c where a call to close() is racing
- * with a call to recvmmsg(). If close() happens before recvmmsg() has chance
- * to check if the file descriptor is open then recvmmsg() completes very
- * quickly. If the call to close() happens once recvmmsg() has already checked
- * the descriptor it takes much longer. The sample where recvmmsg() completes
- * quickly is essentially invalid for our purposes. The test uses the simple
- * heuristic of whether recvmmsg() returns EBADF, to decide if it should call
- * fzsync_pair_add_bias() to further delay syscall B.
+ * @relates fzsync_explore
  */
-static inline void fzsync_pair_add_bias(struct fzsync_pair *pair, int change)
+static inline void fzsync_explore_info(struct fzsync_explore *ex)
 {
-	if (pair->sampling > 0)
-		pair->delay_bias += change;
+	struct timespec now;
+
+	fzsync_time(&now);
+	fzsync_printf("explore: preemptions = %d, interleavings = %lld, max choices = %d, %.0f/s",
+		      ex->preemptions, ex->interleavings, ex->max_choices,
+		      ex->interleavings / (fzsync_diff_ns(now, ex->start) * 1e-9));
 }
 
 #endif /* FUZZY_SYNC_H__ */
@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/**
+ * @file fuzzy_sync_workload.h
+ * Synthetic race workloads for benchmarking fzsync
+ *
+ * The races in the basic and multi tests are made of sched_yield()
+ * calls, so the length of a window depends on the scheduler and is not
+ * known in nanoseconds. This module instead spins on the clock, so
+ * each window has a known length or distribution of lengths, down to
+ * the time taken to read the clock. Changes to the library can then be
+ * compared on real threads against a known ground truth.
+ *
+ * Like the tests, a race has a window in each thread and each window
+ * has a critical section:
+ *
+ * static const struct fzsync_wl_race race = {
+ *	.name = "a-early",
+ *	.a = { FZSYNC_WL_CONST_NS(500), FZSYNC_WL_CONST_NS(100),
+ *	       FZSYNC_WL_CONST_NS(4000) },
+ *	.b = { { FZSYNC_WL_NORMAL, .ns = 3000, .dev = 300 },
+ *	       FZSYNC_WL_CONST_NS(100), FZSYNC_WL_CONST_NS(500) },
+ * };
+ *
+ * Thread A then runs fzsync_wl_run(&wl, &race.a, ...) between
+ * fzsync_start_race_a() and fzsync_end_race_a(), and likewise for B.
+ *
+ * Races can also be loaded from a file with fzsync_wl_load(). This
+ * header needs libm.
+ */
+
+#ifndef FUZZY_SYNC_WORKLOAD_H__
+#define FUZZY_SYNC_WORKLOAD_H__
+
+#include "fuzzy_sync.h"
+
+/** The longest length a distribution can produce, to cap heavy tails */
+#define FZSYNC_WL_MAX_NS 100000000.0f
+/** The longest line in a race file */
+#define FZSYNC_WL_LINE 512
+
+/** The kinds of distribution of a length of time */
+enum fzsync_wl_kind {
+	/** Always ns */
+	FZSYNC_WL_CONST,
+	/** Normally distributed with mean ns and standard deviation dev */
+	FZSYNC_WL_NORMAL,
+	/** ns, except with probability p it is slow_ns */
+	FZSYNC_WL_BIMODAL,
+	/** Pareto distributed with minimum ns and shape alpha */
+	FZSYNC_WL_PARETO,
+};
+
+/** A distribution of lengths of time in nanoseconds */
+struct fzsync_wl_dist {
+	enum fzsync_wl_kind kind;
+	/** The constant, mean, fast mode or minimum length */
+	float ns;
+	/** The standard deviation of a normal distribution */
+	float dev;
+	/** The slow mode of a bimodal distribution */
+	float slow_ns;
+	/** The probability of the slow mode */
+	float p;
+	/** The shape of a Pareto distribution, smaller has a heavier tail */
+	float alpha;
+};
+
+/** A constant length of time */
+#define FZSYNC_WL_CONST_NS(len) { FZSYNC_WL_CONST, .ns = (len) }
+
+/** The time signature of a code path containing a critical section */
+struct fzsync_wl_window {
+	/** The delay until the start of the critical section */
+	struct fzsync_wl_dist critical_s;
+	/** The length of the critical section */
+	struct fzsync_wl_dist critical_t;
+	/** The remaining delay until the window ends */
+	struct fzsync_wl_dist return_t;
+};
+
+/** The time signatures of threads A and B */
+struct fzsync_wl_race {
+	char name[32];
+	struct fzsync_wl_window a;
+	struct fzsync_wl_window b;
+};
+
+/**
+ * The resolution of the busy waits
+ *
+ * Each thread should pass its own rand_state to fzsync_wl_run().
+ */
+struct fzsync_wl {
+	/** The time taken to read the clock, the shortest possible wait */
+	float clock_ns;
+};
+
+/**
+ * Measure the time taken to read the clock
+ *
+ * @relates fzsync_wl
+ *
+ * The best of a few attempts is used, in case one of them was
+ * preempted.
+ */
+static inline void fzsync_wl_init(struct fzsync_wl *wl)
+{
+	struct timespec start, end, now;
+	long best = LONG_MAX;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		fzsync_time(&start);
+		for (j = 0; j < 1024; j++)
+			fzsync_time(&now);
+		fzsync_time(&end);
+		best = MIN(best, fzsync_diff_ns(end, start));
+	}
+
+	wl->clock_ns = best / 1024.0f;
+}
+
+/**
+ * Draw a length of time from a distribution
+ *
+ * @relates fzsync_wl_dist
+ * @return The length in nanoseconds, between zero and FZSYNC_WL_MAX_NS
+ */
+static inline float fzsync_wl_sample(const struct fzsync_wl_dist *d,
+				     unsigned short rand_state[3])
+{
+	double u, v, ns = d->ns;
+
+	switch (d->kind) {
+	case FZSYNC_WL_CONST:
+		break;
+	case FZSYNC_WL_NORMAL:
+		u = 1 - erand48(rand_state);
+		v = erand48(rand_state);
+		ns += d->dev * sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+		break;
+	case FZSYNC_WL_BIMODAL:
+		if (erand48(rand_state) < d->p)
+			ns = d->slow_ns;
+		break;
+	case FZSYNC_WL_PARETO:
+		u = 1 - erand48(rand_state);
+		ns /= pow(u, 1 / d->alpha);
+		break;
+	}
+
+	return MIN(MAX(ns, 0.0), (double)FZSYNC_WL_MAX_NS);
+}
+
+/**
+ * Busy wait for a length of time drawn from a distribution
+ *
+ * @relates fzsync_wl
+ *
+ * A calibrated loop count is not used because the speed of a loop
+ * varies with the CPU's frequency and, on a virtual machine, with the
+ * host. Instead the thread spins on the clock with fzsync_wait_until(),
+ * which also yields during long waits so that both threads make
+ * progress on a single CPU.
+ */
+static inline void fzsync_wl_spin(const struct fzsync_wl *wl,
+				  const struct fzsync_wl_dist *d,
+				  unsigned short rand_state[3])
+{
+	struct timespec now;
+
+	fzsync_time(&now);
+	fzsync_wait_until(fzsync_ts_ns(now)
+			  + (long long)(fzsync_wl_sample(d, rand_state)
+					- wl->clock_ns), &now);
+}
+
+/**
+ * Run a window and mark its critical section
+ *
+ * @relates fzsync_wl
+ * @param c A counter shared by both threads
+ * @param cs Set to the value of c after entering the critical section
+ * @param ct Set to the value of c after leaving the critical section
+ *
+ * Both threads increment c when they enter and leave their critical
+ * sections, as in the basic test. If the critical section of A was
+ * entered and left first, A sees cs = 1 and ct = 2. If B's was first,
+ * A sees cs = 3 and ct = 4. Otherwise they overlapped.
+ */
+static inline void fzsync_wl_run(const struct fzsync_wl *wl,
+				 const struct fzsync_wl_window *w,
+				 unsigned short rand_state[3],
+				 int *c, int *cs, int *ct)
+{
+	int s, t;
+
+	fzsync_wl_spin(wl, &w->critical_s, rand_state);
+	s = fzsync_atomic_add_return(1, c);
+	fzsync_wl_spin(wl, &w->critical_t, rand_state);
+	t = fzsync_atomic_add_return(1, c);
+	fzsync_wl_spin(wl, &w->return_t, rand_state);
+
+	if (cs)
+		*cs = s;
+	if (ct)
+		*ct = t;
+}
+
+/**
+ * Parse a distribution
+ *
+ * @relates fzsync_wl_dist
+ * @param str One of "<ns>", "const:<ns>", "normal:<ns>:<dev>",
+ *            "bimodal:<ns>:<slow_ns>:<p>" or "pareto:<ns>:<alpha>"
+ * @return Zero or EINVAL
+ */
+static inline int fzsync_wl_parse_dist(const char *str,
+				       struct fzsync_wl_dist *d)
+{
+	char kind[16];
+	int n;
+
+	memset(d, 0, sizeof(*d));
+
+	if (sscanf(str, "%f%n", &d->ns, &n) == 1 && !str[n])
+		goto check;
+
+	if (sscanf(str, "%15[a-z]:%n", kind, &n) != 1)
+		return EINVAL;
+	str += n;
+
+	if (!strcmp(kind, "const")) {
+		d->kind = FZSYNC_WL_CONST;
+		if (sscanf(str, "%f%n", &d->ns, &n) != 1)
+			return EINVAL;
+	} else if (!strcmp(kind, "normal")) {
+		d->kind = FZSYNC_WL_NORMAL;
+		if (sscanf(str, "%f:%f%n", &d->ns, &d->dev, &n) != 2)
+			return EINVAL;
+	} else if (!strcmp(kind, "bimodal")) {
+		d->kind = FZSYNC_WL_BIMODAL;
+		if (sscanf(str, "%f:%f:%f%n", &d->ns, &d->slow_ns,
+			   &d->p, &n) != 3)
+			return EINVAL;
+	} else if (!strcmp(kind, "pareto")) {
+		d->kind = FZSYNC_WL_PARETO;
+		if (sscanf(str, "%f:%f%n", &d->ns, &d->alpha, &n) != 2
+		    || d->alpha <= 0)
+			return EINVAL;
+	} else {
+		return EINVAL;
+	}
+
+	if (str[n])
+		return EINVAL;
+check:
+	if (d->ns < 0 || d->dev < 0 || d->slow_ns < 0 || d->p < 0 || d->p > 1)
+		return EINVAL;
+
+	return 0;
+}
+
+/**
+ * Load races from a file
+ *
+ * @relates fzsync_wl_race
+ * @param races The array to load the races into
+ * @param max The length of races
+ * @param n Set to the number of races loaded
+ * @return Zero or an error number
+ *
+ * Each line has a name followed by the critical_s, critical_t and
+ * return_t distributions of thread A and then of thread B, separated
+ * by white space. For example:
+ *
+ * # name  a: start  length  return        b: start     length  return
+ * late-b  1000      100     const:5000    normal:4000:400  100  1000
+ *
+ * Empty lines and lines starting with '#' are skipped. Any other line
+ * which can not be parsed is an error.
+ */
+static inline int fzsync_wl_load(const char *path, struct fzsync_wl_race *races,
+				 int max, int *n)
+{
+	struct fzsync_wl_dist *dists[6];
+	char line[FZSYNC_WL_LINE], *tok, *save;
+	int i, lineno = 0, rval = 0;
+	FILE *f = fopen(path, "r");
+
+	*n = 0;
+	if (!f) {
+		rval = errno;
+		fzsync_printf("fopen(%s, r) -> %s", path, strerror(rval));
+		return rval;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		tok = strtok_r(line, " \t\n", &save);
+		if (!tok || tok[0] == '#')
+			continue;
+
+		if (*n == max) {
+			fzsync_printf("%s:%d: more than %d races", path, lineno, max);
+			rval = E2BIG;
+			break;
+		}
+
+		snprintf(races[*n].name, sizeof(races[*n].name), "%s", tok);
+		dists[0] = &races[*n].a.critical_s;
+		dists[1] = &races[*n].a.critical_t;
+		dists[2] = &races[*n].a.return_t;
+		dists[3] = &races[*n].b.critical_s;
+		dists[4] = &races[*n].b.critical_t;
+		dists[5] = &races[*n].b.return_t;
+
+		for (i = 0; i < 6; i++) {
+			tok = strtok_r(NULL, " \t\n", &save);
+			if (!tok || fzsync_wl_parse_dist(tok, dists[i]))
+				break;
+		}
+
+		if (i < 6 || strtok_r(NULL, " \t\n", &save)) {
+			fzsync_printf("%s:%d: can't parse race", path, lineno);
+			rval = EINVAL;
+			break;
+		}
+
+		(*n)++;
+	}
+
+	fclose(f);
+
+	return rval;
+}
+
+#endif /* FUZZY_SYNC_WORKLOAD_H__ */
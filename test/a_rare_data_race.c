@@ -10,10 +10,14 @@
 #define RECORD_LEN 128
 
 static char *record_path;
+static int fused, timed, batched;
 static struct fzsync_pair pair;
 static FILE *record;
 static volatile char winner;
 
+/* Sums for the least squares fit of the start skew against the delay */
+static double skew_n, skew_x, skew_y, skew_xx, skew_xy;
+
 static long long tons(struct timespec ts)
 {
 	long long res = ts.tv_sec;
@@ -50,6 +54,7 @@ static void setup(void)
 
 	fzsync_pair_init(&pair);
 	pair.exec_loops = 100000;
+	pair.batch = 48;
 }
 
 static void *worker(void *v)
@@ -66,6 +71,92 @@ static void *worker(void *v)
 	return v;
 }
 
+static void *fused_worker(void *v)
+{
+	struct timespec delay = { 0, 1 };
+
+	while (fzsync_loop_b(&pair)) {
+		nanosleep(&delay, NULL);
+		winner = 'B';
+	}
+
+	return v;
+}
+
+static void *timed_worker(void *v)
+{
+	struct timespec delay = { 0, 1 };
+
+	while (fzsync_tt_run_b(&pair)) {
+		fzsync_tt_start_race_b(&pair);
+		nanosleep(&delay, NULL);
+		winner = 'B';
+		fzsync_tt_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static void *batched_worker(void *v)
+{
+	struct timespec delay = { 0, 1 };
+
+	while (fzsync_batch_run_b(&pair)) {
+		fzsync_batch_start_race_b(&pair);
+		nanosleep(&delay, NULL);
+		winner = 'B';
+		fzsync_batch_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static void record_race(struct timespec a_start, struct timespec b_start)
+{
+	fprintf(record, "%c,%lld,%lld,%lld,%lld\n", winner,
+		tons(a_start), tons(b_start),
+		tons(pair.a_end), tons(pair.b_end));
+}
+
+/*
+ * With a timed release, a positive delay should start B that much
+ * later than A and a negative one should start A later.
+ */
+static void record_skew(void)
+{
+	double x = -pair.delay_ns;
+	double y = tons(pair.a_start) - tons(pair.b_start);
+
+	if (pair.sampling >= 0)
+		return;
+
+	skew_n++;
+	skew_x += x;
+	skew_y += y;
+	skew_xx += x * x;
+	skew_xy += x * y;
+}
+
+/*
+ * The start skew should follow the delay with a slope of one. Returns
+ * non-zero if it does not.
+ */
+static int check_skew(void)
+{
+	double slope, var = skew_n * skew_xx - skew_x * skew_x;
+
+	if (skew_n < 1000 || var <= 0) {
+		fzsync_printf("Too few delayed races to check the start skew");
+		return 1;
+	}
+
+	slope = (skew_n * skew_xy - skew_x * skew_y) / var;
+	fzsync_printf("Start skew / delay = %.2f over %.0f races",
+		      slope, skew_n);
+
+	return slope < 0.5 || slope > 1.5;
+}
+
 static void run(void)
 {
 	if (fzsync_pair_reset(&pair, worker))
@@ -79,26 +170,145 @@ static void run(void)
 			winner = 'A';
 		fzsync_end_race_a(&pair);
 
+		record_race(pair.a_start, pair.b_start);
+		if (pair.release_lead)
+			record_skew();
+	}
+}
+
+/*
+ * There is no setup phase in the fused loop, so A simply races to write
+ * its name before B. The previous race is recorded once it has ended
+ * at the start of the next one.
+ */
+static void run_fused(void)
+{
+	struct timespec a_start, b_start;
+
+	if (fzsync_pair_reset(&pair, fused_worker))
+		cleanup(1);
+
+	while (fzsync_loop_a(&pair)) {
+		if (pair.exec_loop > 1)
+			record_race(a_start, b_start);
+
+		a_start = pair.a_start;
+		b_start = pair.b_start;
+		winner = 'A';
+	}
+}
+
+/*
+ * The batch length does not divide exec_loops, so the last batch must
+ * be cut short.
+ */
+static void check_loops(int loops)
+{
+	if (loops == pair.exec_loops)
+		return;
+
+	fzsync_printf("Ran %d loops instead of %d", loops, pair.exec_loops);
+	cleanup(1);
+}
+
+/*
+ * Thread B's timings are recorded asynchronously in the time-triggered
+ * mode, so the recorded times for B may be from an earlier attempt.
+ */
+static void run_timed(void)
+{
+	int loops = 0;
+
+	if (fzsync_pair_reset(&pair, timed_worker))
+		cleanup(1);
+
+	while (fzsync_tt_run_a(&pair)) {
+		loops++;
+		winner = 'A';
+
+		fzsync_tt_start_race_a(&pair);
+		if (winner == 'A' && winner == 'B')
+			winner = 'A';
+		fzsync_tt_end_race_a(&pair);
+
+		record_race(pair.a_start, pair.b_start);
+	}
+
+	check_loops(loops);
+}
+
+/*
+ * The timings of each attempt are in the batch slots and are only
+ * copied into the pair at the end of each batch.
+ */
+static void run_batched(void)
+{
+	const struct fzsync_times *a, *b;
+	int loops = 0;
+
+	if (fzsync_pair_reset(&pair, batched_worker))
+		cleanup(1);
+
+	while (fzsync_batch_run_a(&pair)) {
+		loops++;
+		winner = 'A';
+
+		fzsync_batch_start_race_a(&pair);
+		if (winner == 'A' && winner == 'B')
+			winner = 'A';
+		fzsync_batch_end_race_a(&pair);
+
+		a = pair.a_times + pair.a_attempt;
+		b = pair.b_times + pair.a_attempt;
 		fprintf(record, "%c,%lld,%lld,%lld,%lld\n", winner,
-			tons(pair.a_start), tons(pair.b_start),
-			tons(pair.a_end), tons(pair.b_end));
+			tons(a->start), tons(b->start),
+			tons(a->end), tons(b->end));
 	}
+
+	check_loops(loops);
 }
 
 int main(int argc, char *argv[])
 {
 	int opt;
 
-	opt = getopt(argc, argv, "f:");
+	while ((opt = getopt(argc, argv, "f:ltbr")) != -1) {
+		switch (opt) {
+		case 'f':
+			record_path = optarg;
+			break;
+		case 'l':
+			fused = 1;
+			break;
+		case 't':
+			timed = 1;
+			break;
+		case 'b':
+			batched = 1;
+			break;
+		case 'r':
+			pair.release_lead = 1000;
+			break;
+		default:
+			record_path = NULL;
+			break;
+		}
+	}
 
-	if (opt != 'f') {
-		fzsync_printf("Usage: %s -f <path>\n", argv[0]);
+	if (!record_path) {
+		fzsync_printf("Usage: %s [-l|-t|-b] [-r] -f <path>\n", argv[0]);
 		return 1;
 	}
 
-	record_path = optarg;
-
 	setup();
-	run();
-	cleanup(0);
+	if (fused)
+		run_fused();
+	else if (timed)
+		run_timed();
+	else if (batched)
+		run_batched();
+	else
+		run();
+	cleanup(!fused && !timed && !batched && pair.release_lead
+		&& check_skew());
 }
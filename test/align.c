@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that aligning two marks centres the delays on them,
+ * and that the statistics of the marks are restored from a checkpoint.
+ *
+ * Thread A records its mark two thirds of the way through its window.
+ * Thread B's window is longer, it records one mark at the start and
+ * another at the end. Aligning A's mark with B's first mark needs B to
+ * be delayed, so the average delay must be positive. Aligning it with
+ * B's second mark needs A to be delayed, so the average delay must be
+ * negative.
+\*/
+
+#include "check.h"
+
+/* The time from the start of thread A's window to its mark */
+#define A_MARK_NS 200000
+/* The time from thread A's mark to the end of its window */
+#define A_REST_NS 100000
+/* The length of thread B's window */
+#define B_NS 400000
+
+static char checkpoint_path[64];
+static struct fzsync_pair pair;
+
+static void spin(long long ns)
+{
+	struct timespec now;
+
+	fzsync_time(&now);
+	fzsync_wait_until(fzsync_ts_ns(now) + ns, &now);
+}
+
+static void *worker(void *v)
+{
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		fzsync_mark_b(&pair, 0);
+		spin(B_NS);
+		fzsync_mark_b(&pair, 1);
+		fzsync_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static float avg_delay(int mark_b)
+{
+	float sum = 0;
+	int n = 0, rval;
+
+	fzsync_pair_align(&pair, 0, mark_b);
+	rval = fzsync_pair_reset(&pair, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return 0;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		spin(A_MARK_NS);
+		fzsync_mark_a(&pair, 0);
+		spin(A_REST_NS);
+		fzsync_end_race_a(&pair);
+
+		if (pair.sampling < 0) {
+			sum += pair.delay;
+			n++;
+		}
+	}
+
+	fzsync_pair_cleanup(&pair);
+
+	check(n > 100);
+	fzsync_printf("Aligned with mark_b%d: avg. delay = %.0f", mark_b,
+		      n ? sum / n : 0);
+
+	return n ? sum / n : 0;
+}
+
+static void saved(void)
+{
+	const struct fzsync_stat ma = pair.diff_ma, mb = pair.diff_mb;
+
+	pair.checkpoint_path = checkpoint_path;
+	fzsync_checkpoint_save(&pair);
+
+	fzsync_init_stat(&pair.diff_ma);
+	fzsync_init_stat(&pair.diff_mb);
+
+	check(fzsync_checkpoint_load(&pair));
+	check(pair.diff_ma.avg == ma.avg);
+	check(pair.diff_ma.dev_ratio == ma.dev_ratio);
+	check(pair.diff_mb.avg == mb.avg);
+	check(pair.diff_mb.avg_dev == mb.avg_dev);
+
+	pair.checkpoint_path = NULL;
+	unlink(checkpoint_path);
+}
+
+int main(void)
+{
+	check_path(checkpoint_path, sizeof(checkpoint_path), "align.txt");
+
+	pair.min_samples = 100;
+	pair.exec_time = 2;
+	fzsync_pair_init(&pair);
+
+	check(avg_delay(0) > 0);
+	check(avg_delay(1) < 0);
+	saved();
+
+	return check_result();
+}
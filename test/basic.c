@@ -62,9 +62,23 @@
  *
  * Any other combination of 'cs' and 'ct' means the critical sections
  * overlapped.
+ *
+ * The critical sections are also marked with fzsync_cs_enter_a() and
+ * friends. The library's classification is compared with the one
+ * from 'c' and the number of disagreements is printed after '?'. The
+ * test fails if they disagree on more than 1% of the races. Some
+ * disagreement is allowed because the timestamps bracket the critical
+ * sections, so a race which only just misses may be classified as
+ * overlapping.
+ *
+ * With -l the same races are run with fzsync_loop_a() and
+ * fzsync_loop_b(). Thread B may still be finishing its race when A
+ * has finished, so instead of resetting 'c' after each race, A
+ * subtracts the four increments of each previous race. The loop rate
+ * of each race is printed so that the two modes can be compared.
 \*/
 
-#include "fuzzy_sync.h"
+#include "check.h"
 
 #ifndef DEBUG
 # define DEBUG 0
@@ -97,7 +111,7 @@ struct race {
 	const struct window b;
 };
 
-static int c;
+static int c, fused;
 static struct fzsync_pair pair;
 
 static const struct race races[] = {
@@ -166,7 +180,7 @@ static void *worker(void *v)
 {
 	unsigned int i = *(unsigned int *)v;
 	const struct window b = races[i].b;
-	struct timespec s_time, window_s_time, window_t_time;
+	struct timespec s_time;
 	struct fzsync_stat s = { 0 }, t = { 0 };
 
 
@@ -177,17 +191,17 @@ static void *worker(void *v)
 
 		delay(b.critical_s);
 
+		fzsync_cs_enter_b(&pair);
 		fzsync_atomic_add_return(1, &c);
-		fzsync_time(&window_s_time);
 		delay(b.critical_t);
 		fzsync_atomic_add_return(1, &c);
-		fzsync_time(&window_t_time);
+		fzsync_cs_exit_b(&pair);
 
 		delay(b.return_t);
 		fzsync_end_race_b(&pair);
 
-		fzsync_upd_diff_stat(&s, 0.25, window_s_time, s_time);
-		fzsync_upd_diff_stat(&t, 0.25, window_t_time, s_time);
+		fzsync_upd_diff_stat(&s, 0.25, pair.b_cs_enter, s_time);
+		fzsync_upd_diff_stat(&t, 0.25, pair.b_cs_exit, s_time);
 
 		if (!DEBUG || (pair.exec_loop != 5000 && pair.exec_loop % 100000 > 0))
 			continue;
@@ -199,6 +213,33 @@ static void *worker(void *v)
 	return NULL;
 }
 
+static void *worker_fused(void *v)
+{
+	unsigned int i = *(unsigned int *)v;
+	const struct window b = races[i].b;
+
+	while (fzsync_loop_b(&pair)) {
+		delay(b.critical_s);
+
+		fzsync_atomic_add_return(1, &c);
+		delay(b.critical_t);
+		fzsync_atomic_add_return(1, &c);
+
+		delay(b.return_t);
+	}
+
+	return NULL;
+}
+
+static float loop_rate(struct timespec start)
+{
+	struct timespec now;
+
+	fzsync_time(&now);
+
+	return pair.exec_loop / (fzsync_diff_ns(now, start) * 1e-9);
+}
+
 static void run(unsigned int i)
 {
 	const struct window a = races[i].a;
@@ -207,10 +248,12 @@ static void run(unsigned int i)
 		.arg = &i,
 	};
 	int rval;
-	int cs, ct, r, too_early = 0, critical = 0, too_late = 0;
-	struct timespec s_time, window_s_time, window_t_time;
+	int cs, ct, r, too_early = 0, critical = 0, too_late = 0, wrong = 0;
+	enum fzsync_outcome outcome;
+	struct timespec start, s_time;
 	struct fzsync_stat s = { 0 }, t = { 0 };
 
+	fzsync_time(&start);
 	fzsync_pair_reset(&pair, NULL);
 	rval = pthread_create(&pair.thread_b, 0, fzsync_thread_wrapper,
 			      &wrap_run_b);
@@ -225,21 +268,28 @@ static void run(unsigned int i)
 		fzsync_start_race_a(&pair);
 		delay(a.critical_s);
 
-		fzsync_time(&window_s_time);
+		fzsync_cs_enter_a(&pair);
 		cs = fzsync_atomic_add_return(1, &c);
 		delay(a.critical_t);
 		ct = fzsync_atomic_add_return(1, &c);
-		fzsync_time(&window_t_time);
+		fzsync_cs_exit_a(&pair);
 
 		delay(a.return_t);
 		fzsync_end_race_a(&pair);
 
-		if (cs == 1 && ct == 2)
+		if (cs == 1 && ct == 2) {
 			too_early++;
-		else if (cs == 3 && ct == 4)
+			outcome = FZSYNC_BEFORE;
+		} else if (cs == 3 && ct == 4) {
 			too_late++;
-		else
+			outcome = FZSYNC_AFTER;
+		} else {
 			critical++;
+			outcome = FZSYNC_OVERLAP;
+		}
+
+		if (outcome != fzsync_cs_outcome(&pair))
+			wrong++;
 
 		r = fzsync_atomic_add_return(-4, &c);
 		if (r) {
@@ -247,8 +297,8 @@ static void run(unsigned int i)
 			return;
 		}
 
-		fzsync_upd_diff_stat(&s, 0.25, window_s_time, s_time);
-		fzsync_upd_diff_stat(&t, 0.25, window_t_time, s_time);
+		fzsync_upd_diff_stat(&s, 0.25, pair.a_cs_enter, s_time);
+		fzsync_upd_diff_stat(&t, 0.25, pair.a_cs_exit, s_time);
 
 		if (critical > 100) {
 			fzsync_pair_cleanup(&pair);
@@ -263,19 +313,87 @@ static void run(unsigned int i)
 	}
 
 	fzsync_printf(
-		"acs:%-2d act:%-2d art:%-2d | =:%-4d -:%-4d +:%-4d\n",
+		"acs:%-2d act:%-2d art:%-2d | =:%-4d -:%-4d +:%-4d ?:%-4d | %.0f/s\n",
+		a.critical_s, a.critical_t, a.return_t,
+		critical, too_early, too_late, wrong, loop_rate(start));
+
+	check(wrong * 100 <= critical + too_early + too_late);
+}
+
+static void run_fused(unsigned int i)
+{
+	const struct window a = races[i].a;
+	struct fzsync_run_thread wrap_run_b = {
+		.func = worker_fused,
+		.arg = &i,
+	};
+	int rval, base = 0;
+	int cs, ct, too_early = 0, critical = 0, too_late = 0;
+	struct timespec start;
+
+	fzsync_time(&start);
+	fzsync_pair_reset(&pair, NULL);
+	c = 0;
+	rval = pthread_create(&pair.thread_b, 0, fzsync_thread_wrapper,
+			      &wrap_run_b);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		return;
+	}
+
+	while (fzsync_loop_a(&pair)) {
+		delay(a.critical_s);
+
+		cs = fzsync_atomic_add_return(1, &c) - base;
+		delay(a.critical_t);
+		ct = fzsync_atomic_add_return(1, &c) - base;
+
+		delay(a.return_t);
+		base += 4;
+
+		if (cs == 1 && ct == 2)
+			too_early++;
+		else if (cs == 3 && ct == 4)
+			too_late++;
+		else
+			critical++;
+
+		if (critical > 100) {
+			fzsync_pair_cleanup(&pair);
+			break;
+		}
+	}
+
+	fzsync_printf(
+		"acs:%-2d act:%-2d art:%-2d | =:%-4d -:%-4d +:%-4d | %.0f/s\n",
 		a.critical_s, a.critical_t, a.return_t,
-		critical, too_early, too_late);
+		critical, too_early, too_late, loop_rate(start));
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
 	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l")) != -1) {
+		switch (opt) {
+		case 'l':
+			fused = 1;
+			break;
+		default:
+			fzsync_printf("Usage: %s [-l]\n", argv[0]);
+			return 1;
+		}
+	}
 
 	setup();
-	for (i = 0; i < ARRAY_SIZE(races); i++)
-		run(i);
+	for (i = 0; i < ARRAY_SIZE(races); i++) {
+		if (fused)
+			run_fused(i);
+		else
+			run(i);
+	}
 	cleanup();
 
-	return 0;
+	return check_result();
 }
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/**
+ * @file check.h
+ * The checks shared by the tests
+ *
+ * A test calls check() for each condition it verifies and returns
+ * check_result() from main(). Any output goes through fzsync_printf(),
+ * so a test which overrides it must do so before including this.
+ */
+
+#ifndef FZSYNC_CHECK_H__
+#define FZSYNC_CHECK_H__
+
+#include "fuzzy_sync.h"
+
+/** Set when any check has failed */
+static int failed;
+
+/** Print the condition and fail the test if it is false */
+#define check(cond) do {					\
+		if (!(cond)) {					\
+			fzsync_printf("FAIL: %s", #cond);	\
+			failed = 1;				\
+		}						\
+	} while (0)
+
+/**
+ * Print whether the test passed
+ *
+ * @return The exit status of the test
+ */
+static inline int check_result(void)
+{
+	fzsync_printf("%s", failed ? "FAIL" : "PASS");
+
+	return failed;
+}
+
+/**
+ * Make a file name which is unique to this process
+ *
+ * Each test also runs as a -1cpu variant, possibly at the same time and
+ * in the same directory, so the files a test creates must not collide.
+ *
+ * @return buf
+ */
+static inline char *check_path(char *buf, size_t size, const char *name)
+{
+	snprintf(buf, size, "%s.%d", name, (int)getpid());
+
+	return buf;
+}
+
+#endif /* FZSYNC_CHECK_H__ */
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that a run interrupted by SIGTERM can be resumed from
+ * its checkpoint.
+ *
+ * Thread A counts an outcome with fzsync_pair_count() every tenth
+ * loop and sends itself SIGTERM half way through. The pair must save
+ * a checkpoint and exit, then restore the previous SIGTERM action on
+ * cleanup. The second run must resume from the checkpoint, finish the
+ * remaining loops with the same total count as an uninterrupted run
+ * and remove the checkpoint.
+\*/
+
+#include "check.h"
+
+#define LOOPS 1000
+
+static char checkpoint_path[64];
+static struct fzsync_pair pair;
+
+static void *worker(void *v)
+{
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		fzsync_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static int sigterm_is_default(void)
+{
+	struct sigaction sa;
+
+	return !sigaction(SIGTERM, NULL, &sa) && sa.sa_handler == SIG_DFL;
+}
+
+static int run(int interrupt)
+{
+	int rval, loops = 0;
+
+	rval = fzsync_pair_reset(&pair, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		return -1;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		fzsync_end_race_a(&pair);
+
+		if (!(pair.exec_loop % 10))
+			fzsync_pair_count(&pair, FZSYNC_HIT);
+		if (interrupt && pair.exec_loop == LOOPS / 2)
+			raise(SIGTERM);
+
+		loops++;
+	}
+
+	fzsync_pair_cleanup(&pair);
+
+	return loops;
+}
+
+int main(void)
+{
+	check_path(checkpoint_path, sizeof(checkpoint_path), "checkpoint.txt");
+	unlink(checkpoint_path);
+
+	pair.checkpoint_path = checkpoint_path;
+	pair.exec_loops = LOOPS;
+	fzsync_pair_init(&pair);
+
+	check(run(1) == LOOPS / 2);
+	check(!access(checkpoint_path, F_OK));
+	check(sigterm_is_default());
+
+	check(run(0) == LOOPS / 2);
+	check(pair.outcomes[FZSYNC_HIT] == LOOPS / 10);
+	check(access(checkpoint_path, F_OK));
+	check(sigterm_is_default());
+
+	fzsync_pair_info(&pair);
+	return check_result();
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the controller thread takes over the bookkeeping
+ * of thread A.
+ *
+ * With a loop limit, thread A must run exactly that many loops and the
+ * controller must have read, or counted as lost, every one of them by
+ * the time fzsync_pair_cleanup() returns. The statistics are only
+ * updated by the controller, so they must have been updated.
+ *
+ * With a time limit and no practical loop limit, the controller must
+ * decide to exit shortly after the time limit is reached.
+ *
+ * With a checkpoint written every second and a loop limit which takes
+ * a few seconds to reach, the checkpoint must have been removed once
+ * the loop limit was reached, even though the controller writes it.
+\*/
+
+#include "check.h"
+
+#define LOOPS 20000
+
+static char checkpoint_path[64];
+static struct fzsync_pair pair;
+
+static void *worker(void *v)
+{
+	while (fzsync_ctl_run_b(&pair)) {
+		fzsync_ctl_start_race_b(&pair);
+		fzsync_ctl_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static int run(int sleep_us)
+{
+	int rval, loops = 0;
+
+	rval = fzsync_pair_reset(&pair, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		return -1;
+	}
+
+	while (fzsync_ctl_run_a(&pair)) {
+		fzsync_ctl_start_race_a(&pair);
+		fzsync_ctl_end_race_a(&pair);
+		if (sleep_us)
+			usleep(sleep_us);
+		loops++;
+	}
+
+	return loops;
+}
+
+static void loop_limit(void)
+{
+	pair.exec_loops = LOOPS;
+
+	check(run(0) == LOOPS);
+	check(!pair.ctl_thread);
+	check(pair.ctl_seq == LOOPS);
+	check(pair.ctl_lost < LOOPS);
+	check(pair.diff_sa.avg > 0);
+
+	fzsync_pair_info(&pair);
+}
+
+static void time_limit(void)
+{
+	struct timespec start, end;
+	long long ns;
+
+	pair.exec_loops = INT_MAX;
+	pair.exec_time = 2;
+
+	fzsync_time(&start);
+	check(run(0) > 0);
+	fzsync_time(&end);
+
+	ns = fzsync_ts_ns(end) - fzsync_ts_ns(start);
+	fzsync_printf("Time limited run took %lldms", ns / 1000000);
+	/* The time limit is only checked to the second */
+	check(ns >= 1000000000LL);
+	check(ns < 6000000000LL);
+	check(pair.exec_loop < INT_MAX);
+}
+
+static void checkpoint(void)
+{
+	unlink(checkpoint_path);
+	pair.checkpoint_path = checkpoint_path;
+	pair.checkpoint_interval = 1;
+	pair.exec_loops = 3000;
+	pair.exec_time = 60;
+
+	check(run(1000) == 3000);
+	check(access(checkpoint_path, F_OK));
+
+	unlink(checkpoint_path);
+	pair.checkpoint_path = NULL;
+}
+
+int main(void)
+{
+	check_path(checkpoint_path, sizeof(checkpoint_path),
+		   "controller-checkpoint.txt");
+	fzsync_pair_init(&pair);
+
+	loop_limit();
+	time_limit();
+	checkpoint();
+
+	return check_result();
+}
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that fzsync_explore runs every interleaving of a race
+ * model within the preemption bound exactly once.
+ *
+ * The windows are the same as in basic, except that each unit of delay
+ * is a yield instead of a cubed number of sched_yield() calls. If A has
+ * m yields and B has n, then without a bound there are
+ * (m + n + 2)! / ((m + 1)! (n + 1)!) interleavings. With a bound of one
+ * preemption there are m + n + 2. Either way the critical sections must
+ * overlap in some interleaving if either has a yield inside it.
+ *
+ * The last model needs the steps of A and B to alternate, A1 B1 A2 B2.
+ * That takes two preemptions, so it is only found with a bound of two
+ * or more and then only in one interleaving.
+\*/
+
+#include "check.h"
+
+#ifndef ARRAY_SIZE
+# define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+/* The time signature of a code path containing a critical section. */
+struct window {
+	/* The number of steps until the start of the critical section */
+	const int critical_s;
+	/* The length of the critical section */
+	const int critical_t;
+	/* The remaining steps until the method returns */
+	const int return_t;
+};
+
+/* The time signatures of threads A and B */
+struct race {
+	const struct window a;
+	const struct window b;
+};
+
+static const struct race races[] = {
+	{ .a = { 0, 0, 0 }, .b = { 0, 0, 0 } },
+	{ .a = { 1, 1, 1 }, .b = { 1, 1, 1 } },
+	{ .a = { 3, 1, 1 }, .b = { 1, 1, 3 } },
+	{ .a = { 3, 1, 1 }, .b = { 1, 1, 2 } },
+	{ .a = { 3, 1, 0 }, .b = { 0, 1, 3 } },
+	{ .a = { 3, 1, 1 }, .b = { 0, 1, 0 } },
+	{ .a = { 3, 1, 1 }, .b = { 0, 0, 0 } },
+	{ .a = { 4, 2, 4 }, .b = { 2, 2, 2 } },
+};
+
+static struct fzsync_explore ex;
+static const struct race *race;
+static int c, cs, ct, a_step, b_step;
+
+static void delay(int t)
+{
+	while (t--)
+		fzsync_explore_yield(&ex);
+}
+
+static void window_a(void *v)
+{
+	const struct window *w = v;
+
+	delay(w->critical_s);
+	cs = ++c;
+	delay(w->critical_t);
+	ct = ++c;
+	delay(w->return_t);
+}
+
+static void window_b(void *v)
+{
+	const struct window *w = v;
+
+	delay(w->critical_s);
+	++c;
+	delay(w->critical_t);
+	++c;
+	delay(w->return_t);
+}
+
+static void race_a(void *v)
+{
+	window_a((void *)&((const struct race *)v)->a);
+}
+
+static void race_b(void *v)
+{
+	window_b((void *)&((const struct race *)v)->b);
+}
+
+static long long binomial(int n, int k)
+{
+	long long r = 1;
+	int i;
+
+	for (i = 1; i <= k; i++)
+		r = r * (n - k + i) / i;
+
+	return r;
+}
+
+static void run_windows(unsigned int i, int preemptions)
+{
+	const struct window a = races[i].a, b = races[i].b;
+	int more, m, n, critical = 0;
+	long long expected;
+
+	m = a.critical_s + a.critical_t + a.return_t;
+	n = b.critical_s + b.critical_t + b.return_t;
+	expected = preemptions ? m + n + 2 : binomial(m + n + 2, m + 1);
+
+	race = races + i;
+	ex.preemptions = preemptions;
+	fzsync_explore_reset(&ex);
+
+	do {
+		c = 0;
+		more = fzsync_explore_run(&ex, race_a, race_b, (void *)race);
+		critical += !(cs == 1 && ct == 2) && !(cs == 3 && ct == 4);
+	} while (more);
+
+	fzsync_printf("%d| p:%d =:%-4d of %lld", i, preemptions, critical,
+		      ex.interleavings);
+
+	check(ex.interleavings == expected);
+	check(!critical == !(a.critical_t || b.critical_t));
+}
+
+static void alternate_a(void *v)
+{
+	a_step = 1;
+	fzsync_explore_yield(&ex);
+	if (b_step == 1)
+		a_step = 2;
+	(void)v;
+}
+
+static void alternate_b(void *v)
+{
+	if (a_step == 1)
+		b_step = 1;
+	fzsync_explore_yield(&ex);
+	if (a_step == 2)
+		b_step = 2;
+	(void)v;
+}
+
+static int run_alternate(int preemptions)
+{
+	int more, hits = 0;
+
+	ex.preemptions = preemptions;
+	fzsync_explore_reset(&ex);
+
+	do {
+		a_step = b_step = 0;
+		more = fzsync_explore_run(&ex, alternate_a, alternate_b, NULL);
+		hits += b_step == 2;
+	} while (more);
+
+	fzsync_printf("alternate| p:%d =:%d of %lld", preemptions, hits,
+		      ex.interleavings);
+
+	return hits;
+}
+
+int main(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(races); i++) {
+		run_windows(i, 1);
+		run_windows(i, 0);
+	}
+	fzsync_explore_info(&ex);
+
+	check(run_alternate(1) == 0);
+	check(run_alternate(2) == 1);
+	check(run_alternate(0) == 1);
+	check(ex.interleavings == 6);
+
+	fzsync_explore_cleanup(&ex);
+	return check_result();
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies the exit handshake when the caller starts thread B
+ * itself, as basic and multi do.
+ *
+ * Thread B is created with fzsync_thread_wrapper() and a
+ * fzsync_run_thread on the caller's stack, then fzsync_pair_reset() is
+ * called without run_b. Thread A breaks out of its loop early, so the
+ * exit is requested by fzsync_pair_cleanup(). Thread B must acknowledge
+ * it through the pair well within FZSYNC_EXIT_NS, so that it is joined
+ * rather than cancelled.
+\*/
+
+#include "check.h"
+
+#define BREAK_LOOP 100
+
+static struct fzsync_pair pair;
+static int b_returned;
+
+static void *worker(void *v)
+{
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		fzsync_end_race_b(&pair);
+	}
+
+	fzsync_atomic_store(1, &b_returned);
+
+	return v;
+}
+
+static void run(void)
+{
+	struct fzsync_run_thread wrap_run_b = {
+		.func = worker,
+		.arg = NULL,
+	};
+	struct timespec start, end;
+	int rval;
+
+	check(!fzsync_pair_reset(&pair, NULL));
+	rval = pthread_create(&pair.thread_b, 0, fzsync_thread_wrapper,
+			      &wrap_run_b);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		fzsync_end_race_a(&pair);
+
+		if (pair.exec_loop == BREAK_LOOP)
+			break;
+	}
+
+	fzsync_time(&start);
+	check(!fzsync_pair_cleanup(&pair));
+	fzsync_time(&end);
+
+	fzsync_printf("cleanup took %ldns", fzsync_diff_ns(end, start));
+	check(fzsync_diff_ns(end, start) < FZSYNC_EXIT_NS / 2);
+	check(pair.b_done);
+	check(b_returned);
+	check(!pair.thread_b);
+}
+
+int main(void)
+{
+	fzsync_pair_init(&pair);
+	run();
+
+	return check_result();
+}
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies Fuzzy Sync's ability to reproduce a three way data
+ * race with fzsync_group when the critical sections are not aligned.
+ *
+ * The assumptions are the same as in basic, except that there are
+ * three threads which each contain a single critical section. The
+ * race is only reproduced when all three critical sections overlap.
+ *
+ * Each thread increments the 'c' counter when it enters its critical
+ * section and decrements it when leaving. If a thread sees 'c' reach
+ * three on entry, then all three critical sections overlap. The test
+ * fails unless each race overlaps more than 100 times before the time
+ * limit. The counter must also be back to zero after every race.
+\*/
+
+#include "check.h"
+
+#ifndef ARRAY_SIZE
+# define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+/* See basic */
+#define TIME_SCALE(x) ((x) * (x) * (x))
+
+/* The time signature of a code path containing a critical section. */
+struct window {
+	/* The delay until the start of the critical section */
+	const int critical_s;
+	/* The length of the critical section */
+	const int critical_t;
+	/* The remaining delay until the method returns */
+	const int return_t;
+};
+
+/* The time signatures of each member */
+struct race {
+	const struct window w[3];
+};
+
+static int c, hit;
+static unsigned int race_i;
+static struct fzsync_group group;
+
+static const struct race races[] = {
+	/* Already aligned */
+	{ { { 0, 2, 0 }, { 0, 2, 0 }, { 0, 2, 0 } } },
+	{ { { 1, 2, 1 }, { 1, 2, 1 }, { 1, 2, 1 } } },
+
+	/* Critical sections at different ends */
+	{ { { 3, 2, 1 }, { 1, 2, 3 }, { 2, 2, 2 } } },
+
+	/* Different sized windows */
+	{ { { 3, 2, 0 }, { 0, 2, 2 }, { 1, 2, 1 } } },
+};
+
+static void setup(void)
+{
+	group.n = 3;
+	group.min_samples = 5000;
+
+	fzsync_group_init(&group);
+}
+
+static void delay(const int t)
+{
+	int k = TIME_SCALE(t);
+
+	while (fzsync_atomic_add_return(-1, &k) > 0)
+		sched_yield();
+}
+
+static void race(const struct window w)
+{
+	delay(w.critical_s);
+
+	if (fzsync_atomic_add_return(1, &c) == group.n)
+		fzsync_atomic_store(1, &hit);
+	delay(w.critical_t);
+	fzsync_atomic_add_return(-1, &c);
+
+	delay(w.return_t);
+}
+
+static void *worker(void *v)
+{
+	struct fzsync_member *m = v;
+	const struct window w = races[race_i].w[m->id];
+
+	while (fzsync_group_run(m->group, m->id)) {
+		fzsync_group_start_race(m->group, m->id);
+		race(w);
+		fzsync_group_end_race(m->group, m->id);
+	}
+
+	return NULL;
+}
+
+static void run(unsigned int i)
+{
+	const struct window w = races[i].w[0];
+	int rval, critical = 0;
+
+	race_i = i;
+	rval = fzsync_group_reset(&group, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+
+	while (fzsync_group_run(&group, 0)) {
+		fzsync_group_start_race(&group, 0);
+		race(w);
+		fzsync_group_end_race(&group, 0);
+		check(!fzsync_atomic_load(&c));
+
+		if (hit) {
+			critical++;
+			hit = 0;
+		}
+
+		if (critical > 100) {
+			fzsync_group_cleanup(&group);
+			break;
+		}
+	}
+
+	fzsync_printf("%d| =:%-4d", i, critical);
+	check(critical > 100);
+}
+
+int main(void)
+{
+	unsigned int i;
+
+	setup();
+	for (i = 0; i < ARRAY_SIZE(races); i++)
+		run(i);
+	fzsync_group_cleanup(&group);
+
+	return check_result();
+}
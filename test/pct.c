@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the PCT mode finds a bug of depth three with the
+ * expected probability and only runs one thread at a time.
+ *
+ * Each thread yields STEPS times in its race. Thread A sets a flag at
+ * its middle step and clears it at the next. The bug is hit when thread
+ * B sees the flag at its own middle step. That needs thread A to reach
+ * the middle first, then thread B to run before thread A continues.
+ *
+ * Each thread also marks when it is running between yields. Neither
+ * thread may see the other running.
+\*/
+
+#include "check.h"
+
+#define LOOPS 20000
+#define STEPS 10
+
+static struct fzsync_pair pair;
+static int a_mid, a_running, b_running, hits, overlaps;
+
+static void enter(int *self, int *other)
+{
+	fzsync_atomic_store(1, self);
+	if (fzsync_atomic_load(other))
+		fzsync_atomic_inc(&overlaps);
+}
+
+static void leave(int *self)
+{
+	fzsync_atomic_store(0, self);
+}
+
+static void *worker(void *v)
+{
+	int i;
+
+	while (fzsync_pct_run_b(&pair)) {
+		fzsync_pct_start_race_b(&pair);
+		for (i = 0; i < STEPS; i++) {
+			enter(&b_running, &a_running);
+			if (i == STEPS / 2 && fzsync_atomic_load(&a_mid))
+				hits++;
+			leave(&b_running);
+			fzsync_pct_yield_b(&pair);
+		}
+		fzsync_pct_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+int main(void)
+{
+	int i, rval;
+	double k, expected;
+
+	pair.exec_loops = LOOPS;
+	pair.pct_depth = 3;
+	fzsync_pair_init(&pair);
+
+	rval = fzsync_pair_reset(&pair, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		return 1;
+	}
+
+	while (fzsync_pct_run_a(&pair)) {
+		fzsync_pct_start_race_a(&pair);
+		for (i = 0; i < STEPS; i++) {
+			enter(&a_running, &b_running);
+			fzsync_atomic_store(i == STEPS / 2, &a_mid);
+			leave(&a_running);
+			fzsync_pct_yield_a(&pair);
+		}
+		fzsync_atomic_store(0, &a_mid);
+		fzsync_pct_end_race_a(&pair);
+	}
+
+	k = pair.pct_steps;
+	expected = LOOPS / (2 * k * k);
+	fzsync_printf("hits = %d, expected at least %.0f, overlaps = %d",
+		      hits, expected, overlaps);
+
+	check(k >= 2 * STEPS && k <= 2 * STEPS + 1);
+	check(hits >= expected / 2);
+	check(!overlaps);
+
+	return check_result();
+}
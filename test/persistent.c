@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that a persistent thread B is reused across resets.
+ *
+ * Several short runs alternate between two thread B functions, each
+ * with its own argument. Every run must be performed by the same
+ * thread with the function and argument it was handed. This includes
+ * the run after one which thread A left early, because thread B must
+ * notice the exit request and park. Clearing persistent must stop the
+ * worker on cleanup.
+\*/
+
+#include "check.h"
+
+#define RUNS 8
+#define LOOPS 200
+
+static struct fzsync_pair pair;
+static __thread int marked;
+static int threads, calls[2];
+
+static void seen(void)
+{
+	if (!marked) {
+		marked = 1;
+		threads++;
+	}
+}
+
+static void *worker_even(void *arg)
+{
+	seen();
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		(*(int *)arg)++;
+		fzsync_end_race_b(&pair);
+	}
+
+	return NULL;
+}
+
+static void *worker_odd(void *arg)
+{
+	seen();
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		(*(int *)arg) += 2;
+		fzsync_end_race_b(&pair);
+	}
+
+	return NULL;
+}
+
+static void run(int i, int loops)
+{
+	void *(*worker)(void *) = i & 1 ? worker_odd : worker_even;
+	int rval, *arg = calls + (i & 1), before = *arg;
+
+	rval = fzsync_pair_reset_arg(&pair, worker, arg);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		fzsync_end_race_a(&pair);
+
+		if (pair.exec_loop == loops)
+			break;
+	}
+	fzsync_pair_cleanup(&pair);
+
+	if (loops > 0)
+		check(*arg - before == (i & 1 ? 2 : 1) * loops);
+	else
+		check(*arg - before == (i & 1 ? 2 : 1) * LOOPS);
+}
+
+int main(void)
+{
+	int i;
+
+	pair.exec_loops = LOOPS;
+	pair.min_samples = 100;
+	pair.persistent = 1;
+	fzsync_pair_init(&pair);
+
+	for (i = 0; i < RUNS; i++)
+		run(i, -1);
+
+	check(threads == 1);
+	check(pair.thread_b && pair.worker);
+
+	run(0, 10);
+	run(1, -1);
+	check(threads == 1);
+
+	pair.persistent = 0;
+	fzsync_pair_cleanup(&pair);
+	check(!pair.thread_b && !pair.worker);
+
+	fzsync_printf("%d runs on %d threads", RUNS + 2, threads);
+	return check_result();
+}
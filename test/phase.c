@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the delay of a phase moves the threads relative to
+ * each other at that phase, and that the statistics of the phases are
+ * restored from a checkpoint.
+ *
+ * Each race has one phase. Once sampling has finished, the phase's
+ * delay is positive in some races, which delays thread B, and negative
+ * in others, which delays thread A. The test fails unless each thread
+ * spends longer in the phase, on average, when the delay is against it.
+ *
+ * The time in the phase is measured as CPU time of the thread. On a
+ * single CPU the wall clock mostly shows when the threads were
+ * scheduled, while the barrier's waits yield and use little CPU time.
+ * For the same reason the number of spins per nanosecond is
+ * underestimated and the delays are too short to measure. So thread A
+ * replaces each delay with a long one of the same sign before it
+ * reaches the phase.
+\*/
+
+#include "check.h"
+
+/* See basic */
+#define TIME_SCALE(x) ((x) * (x) * (x))
+
+/* The magnitude of the phase delays in spins */
+#define PHASE_DELAY 20000
+
+static char checkpoint_path[64];
+static long long b_phase_ns;
+static struct fzsync_pair pair;
+
+static long long cpu_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+
+	return fzsync_ts_ns(t);
+}
+
+static void delay(const int t)
+{
+	int k = TIME_SCALE(t);
+
+	while (fzsync_atomic_add_return(-1, &k) > 0)
+		sched_yield();
+}
+
+static void *worker(void *v)
+{
+	long long t;
+
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		delay(1);
+		t = cpu_ns();
+		fzsync_phase_b(&pair, 0);
+		b_phase_ns = cpu_ns() - t;
+		delay(3);
+		fzsync_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static void moves(void)
+{
+	struct fzsync_phase *p = pair.phases;
+	double a_ns[2] = { 0 }, b_ns[2] = { 0 };
+	int n[2] = { 0 }, d, rval;
+	long long t, a_phase_ns;
+
+	rval = fzsync_pair_reset(&pair, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		d = p->delay;
+		if (d)
+			p->delay = d > 0 ? PHASE_DELAY : -PHASE_DELAY;
+		delay(1);
+		t = cpu_ns();
+		fzsync_phase_a(&pair, 0);
+		a_phase_ns = cpu_ns() - t;
+		delay(3);
+		fzsync_end_race_a(&pair);
+
+		if (!d)
+			continue;
+
+		a_ns[d > 0] += a_phase_ns;
+		b_ns[d > 0] += b_phase_ns;
+		n[d > 0]++;
+	}
+
+	fzsync_pair_cleanup(&pair);
+
+	check(n[0] > 100 && n[1] > 100);
+	if (!n[0] || !n[1])
+		return;
+
+	fzsync_printf("A is delayed: a = %.0fns, b = %.0fns",
+		      a_ns[0] / n[0], b_ns[0] / n[0]);
+	fzsync_printf("B is delayed: a = %.0fns, b = %.0fns",
+		      a_ns[1] / n[1], b_ns[1] / n[1]);
+	check(a_ns[0] / n[0] > a_ns[1] / n[1]);
+	check(b_ns[1] / n[1] > b_ns[0] / n[0]);
+}
+
+static void saved(void)
+{
+	const struct fzsync_phase p = pair.phases[0];
+
+	pair.checkpoint_path = checkpoint_path;
+	fzsync_checkpoint_save(&pair);
+
+	pair.phase_n = 0;
+	fzsync_init_stat(&pair.phases[0].diff_sa);
+	fzsync_init_stat(&pair.phases[0].diff_sb);
+
+	check(fzsync_checkpoint_load(&pair));
+	check(pair.phase_n == 1);
+	check(pair.phases[0].diff_sa.avg == p.diff_sa.avg);
+	check(pair.phases[0].diff_sa.avg_dev == p.diff_sa.avg_dev);
+	check(pair.phases[0].diff_sb.avg == p.diff_sb.avg);
+	check(pair.phases[0].diff_sb.dev_ratio == p.diff_sb.dev_ratio);
+
+	pair.checkpoint_path = NULL;
+	unlink(checkpoint_path);
+}
+
+int main(void)
+{
+	check_path(checkpoint_path, sizeof(checkpoint_path), "phase.txt");
+
+	pair.exec_loops = 5000;
+	pair.exec_time = 20;
+	fzsync_pair_init(&pair);
+
+	moves();
+	saved();
+
+	return check_result();
+}
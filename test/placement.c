@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that threads A and B are pinned according to the
+ * placement and that the rotation through placements accounts for
+ * every loop and hit.
+ *
+ * Placing both threads on the same CPU must be possible wherever the
+ * topology can be read from /sys. Thread A's affinity must be restored
+ * on cleanup. With a single CPU, placements needing two CPUs must fall
+ * back to the scheduler.
+ *
+ * The latency probe must measure a positive time per barrier. With
+ * more than one CPU, the fastest placement must use two different CPUs.
+ * A new pair must take their latency from the cache and a pair which
+ * has already found them must not need the cache.
+ *
+ * When rotating, the loops and hits of each placement must add up to
+ * the totals and at least two placements must have been run.
+\*/
+
+#include "check.h"
+
+#define LOOPS 4000
+
+static char latency_path[64];
+static struct fzsync_pair pair;
+static int b_cpu;
+
+static void *worker(void *v)
+{
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		b_cpu = sched_getcpu();
+		fzsync_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static int affinity_count(void)
+{
+	cpu_set_t set;
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+		return -1;
+
+	return CPU_COUNT(&set);
+}
+
+static void run(void)
+{
+	int rval = fzsync_pair_reset(&pair, worker);
+
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		fzsync_end_race_a(&pair);
+
+		if (!(pair.exec_loop % 4))
+			fzsync_pair_count(&pair, FZSYNC_HIT);
+	}
+}
+
+static void same_cpu(void)
+{
+	int before = affinity_count();
+
+	pair.placement = FZSYNC_PLACE_SAME_CPU;
+	check(!fzsync_pair_reset(&pair, worker));
+	check(pair.cpu_a >= 0 && pair.cpu_a == pair.cpu_b);
+	check(affinity_count() == 1);
+	check(sched_getcpu() == pair.cpu_a);
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		fzsync_end_race_a(&pair);
+		check(b_cpu == sched_getcpu());
+		if (pair.exec_loop > 10)
+			break;
+	}
+	fzsync_pair_cleanup(&pair);
+
+	check(pair.cpu_a == -1);
+	check(affinity_count() == before);
+}
+
+static void unavailable(void)
+{
+	int cpus[2];
+
+	if (fzsync_cpus(cpus, 2) > 1)
+		return;
+
+	pair.placement = FZSYNC_PLACE_CROSS_LLC;
+	check(!fzsync_pair_reset(&pair, NULL));
+	check(pair.cpu_a == -1);
+	check(pair.place == FZSYNC_PLACE_CROSS_LLC);
+	fzsync_pair_cleanup(&pair);
+}
+
+static int cache_lines(void)
+{
+	char line[FZSYNC_PROFILE_LINE];
+	FILE *f = fopen(latency_path, "r");
+	int n = 0;
+
+	while (f && fgets(line, sizeof(line), f))
+		n++;
+	if (f)
+		fclose(f);
+
+	return n;
+}
+
+static void fastest(void)
+{
+	int cpus[2], lines, a, b;
+
+	check(fzsync_latency_probe(sched_getcpu(), sched_getcpu()) > 0);
+
+	unlink(latency_path);
+	pair.placement = FZSYNC_PLACE_FASTEST;
+	pair.latency_path = latency_path;
+	check(!fzsync_pair_reset(&pair, NULL));
+	fzsync_pair_cleanup(&pair);
+
+	if (fzsync_cpus(cpus, 2) < 2) {
+		check(pair.place == FZSYNC_PLACE_FASTEST && pair.cpu_a == -1);
+		return;
+	}
+
+	lines = cache_lines();
+	check(lines > 1);
+
+	pair.fastest_a = pair.fastest_b = -1;
+	check(!fzsync_pair_reset(&pair, NULL));
+	check(pair.cpu_a >= 0 && pair.cpu_b >= 0 && pair.cpu_a != pair.cpu_b);
+	a = pair.cpu_a;
+	b = pair.cpu_b;
+	fzsync_pair_cleanup(&pair);
+	check(cache_lines() == lines);
+
+	unlink(latency_path);
+	check(!fzsync_pair_reset(&pair, NULL));
+	check(pair.cpu_a == a && pair.cpu_b == b);
+	fzsync_pair_cleanup(&pair);
+	check(!cache_lines());
+}
+
+static void rotate(void)
+{
+	long loops = 0, hits = 0;
+	int i, placements = 0;
+
+	pair.placement = FZSYNC_PLACE_ANY;
+	pair.placement_loops = LOOPS / 4;
+	run();
+	fzsync_pair_info(&pair);
+
+	for (i = 0; i < FZSYNC_PLACE_MAX; i++) {
+		loops += pair.place_loops[i];
+		hits += pair.place_hits[i];
+		placements += !!pair.place_loops[i];
+	}
+
+	check(loops == pair.exec_loop);
+	check(hits == pair.outcomes[FZSYNC_HIT]);
+	check(placements >= 2);
+}
+
+int main(void)
+{
+	check_path(latency_path, sizeof(latency_path), "latency.txt");
+
+	pair.exec_loops = LOOPS;
+	pair.min_samples = 100;
+	fzsync_pair_init(&pair);
+
+	same_cpu();
+	unavailable();
+	fastest();
+	rotate();
+
+	return check_result();
+}
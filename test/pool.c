@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that a fzsync_pool runs independent replicas of a race
+ * and aggregates their counts.
+ *
+ * Each replica races two threads which write their name to the
+ * replica's own variable, as in a_rare_data_race. Thread B checks that
+ * it was passed its own replica. Thread A counts a hit whenever B wrote
+ * last. The pool's totals must be the sums of the replicas' counts and
+ * the replicas' random number generators must have different states.
+ *
+ * Then the loop rate of a pool of one replica is compared with that of
+ * a pool with a replica for every two CPUs, or two replicas if there
+ * are fewer than four CPUs. The races are empty so that the rate is
+ * limited by the barriers. The rates depend on what else the machine is
+ * doing, so by default they are only printed. With -s, the larger pool
+ * must have at least half the total rate which perfect scaling would
+ * give, which on two or three CPUs only means that it must not
+ * collapse. This is skipped with a single CPU.
+\*/
+
+#include "check.h"
+
+#define REPLICAS 2
+#define SCALING_LOOPS 100000
+
+static volatile char winner[REPLICAS];
+static int wrong_arg, check_scaling;
+
+static void *worker(void *arg)
+{
+	struct fzsync_replica *r = arg;
+	struct timespec delay = { 0, 1 };
+
+	if (r != r->pool->replicas + r->id)
+		wrong_arg = 1;
+
+	while (fzsync_run_b(&r->pair)) {
+		fzsync_start_race_b(&r->pair);
+		nanosleep(&delay, NULL);
+		winner[r->id] = 'B';
+		fzsync_end_race_b(&r->pair);
+	}
+
+	return NULL;
+}
+
+static void *run(void *arg)
+{
+	struct fzsync_replica *r = arg;
+
+	while (fzsync_run_a(&r->pair)) {
+		winner[r->id] = 'A';
+
+		fzsync_start_race_a(&r->pair);
+		winner[r->id] = 'A';
+		fzsync_end_race_a(&r->pair);
+
+		if (winner[r->id] == 'B')
+			fzsync_pair_count(&r->pair, FZSYNC_HIT);
+	}
+
+	return NULL;
+}
+
+static void *run_empty(void *arg)
+{
+	struct fzsync_replica *r = arg;
+
+	while (fzsync_run_a(&r->pair)) {
+		fzsync_start_race_a(&r->pair);
+		fzsync_end_race_a(&r->pair);
+	}
+
+	return NULL;
+}
+
+static void *worker_empty(void *arg)
+{
+	struct fzsync_replica *r = arg;
+
+	while (fzsync_run_b(&r->pair)) {
+		fzsync_start_race_b(&r->pair);
+		fzsync_end_race_b(&r->pair);
+	}
+
+	return NULL;
+}
+
+/* The total loop rate of a pool of n replicas running empty races */
+static float empty_rate(int n)
+{
+	struct fzsync_pool *pool = calloc(1, sizeof(*pool));
+	float rate = 0;
+	int rval;
+
+	if (!pool)
+		return 0;
+
+	pool->n = n;
+	pool->pair.exec_loops = SCALING_LOOPS;
+	fzsync_pool_init(pool);
+
+	rval = fzsync_pool_run(pool, run_empty, worker_empty);
+	if (rval)
+		fzsync_printf("pthread_create: %s", strerror(rval));
+	else
+		rate = pool->rate;
+
+	fzsync_pool_cleanup(pool);
+	free(pool);
+
+	return rate;
+}
+
+static void aggregate(void)
+{
+	static struct fzsync_pool pool = { .n = REPLICAS };
+	long loops = 0, hits = 0;
+	int i, rval;
+
+	pool.pair.exec_loops = 20000;
+	pool.pair.min_samples = 1000;
+	fzsync_pool_init(&pool);
+
+	rval = fzsync_pool_run(&pool, run, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+
+	for (i = 0; i < REPLICAS; i++) {
+		loops += pool.replicas[i].pair.exec_loop;
+		hits += pool.replicas[i].pair.outcomes[FZSYNC_HIT];
+	}
+
+	check(!wrong_arg);
+	check(loops == pool.loops);
+	check(hits == pool.outcomes[FZSYNC_HIT]);
+	check(memcmp(pool.replicas[0].pair.rand_state,
+		     pool.replicas[1].pair.rand_state,
+		     sizeof(pool.replicas[0].pair.rand_state)));
+
+	fzsync_pool_cleanup(&pool);
+}
+
+static void scaling(void)
+{
+	int cpus[FZSYNC_POOL_MAX];
+	int n_cpus = fzsync_cpus(cpus, FZSYNC_POOL_MAX);
+	int n = MAX(n_cpus / 2, 2);
+	float one, many, min_speedup = 0.5f * MAX(n_cpus / 2, 1);
+
+	if (n_cpus < 2) {
+		fzsync_printf("Skipping the scaling check with 1 CPU");
+		return;
+	}
+
+	one = empty_rate(1);
+	many = empty_rate(n);
+	fzsync_printf("1 replica: %.0f loops/s, %d replicas: %.0f loops/s, speedup = %.2f (min %.2f)",
+		      one, n, many, one > 0 ? many / one : 0, min_speedup);
+
+	check(one > 0);
+	if (check_scaling)
+		check(many >= one * min_speedup);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		switch (opt) {
+		case 's':
+			check_scaling = 1;
+			break;
+		default:
+			fzsync_printf("Usage: %s [-s]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	aggregate();
+	scaling();
+
+	return check_result();
+}
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that thread B can be a process started with clone(2).
+ *
+ * Thread B increments a counter in shared memory and a global variable
+ * in each race. Thread A must see the shared counter incremented in
+ * every race. Without CLONE_VM the pair is allocated with
+ * fzsync_pair_mmap() and A must not see the global change, with
+ * CLONE_VM it must.
+ *
+ * When thread A breaks out of its loop early, thread B's process must
+ * notice the exit request and be reaped promptly.
+\*/
+
+#include "check.h"
+
+#define LOOPS 1000
+
+static struct fzsync_pair *pair;
+static int *counter, global;
+
+static void *worker(void *v)
+{
+	while (fzsync_run_b(pair)) {
+		fzsync_start_race_b(pair);
+		(*counter)++;
+		global++;
+		fzsync_end_race_b(pair);
+	}
+
+	return v;
+}
+
+static void run(int flags, int loops)
+{
+	int rval, missed = 0;
+
+	*counter = 0;
+	global = 0;
+	pair->clone_b = 1;
+	pair->clone_flags = flags;
+
+	rval = fzsync_pair_reset(pair, worker);
+	if (rval) {
+		fzsync_printf("clone: %s", strerror(rval));
+		failed = 1;
+		return;
+	}
+	check(pair->pid_b > 0);
+
+	while (fzsync_run_a(pair)) {
+		fzsync_start_race_a(pair);
+		fzsync_end_race_a(pair);
+
+		missed += *counter != pair->exec_loop;
+		if (pair->exec_loop == loops)
+			break;
+	}
+
+	fzsync_pair_cleanup(pair);
+	check(!missed);
+	check(!pair->pid_b);
+}
+
+static void early_exit(void)
+{
+	struct timespec start, end;
+
+	fzsync_time(&start);
+	run(0, 10);
+	fzsync_time(&end);
+
+	check(*counter == 10);
+	check(fzsync_diff_ns(end, start) < FZSYNC_EXIT_NS);
+}
+
+int main(void)
+{
+	counter = mmap(NULL, sizeof(*counter), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pair = fzsync_pair_mmap();
+	if (counter == MAP_FAILED || !pair) {
+		fzsync_printf("mmap: %s", strerror(errno));
+		return 1;
+	}
+
+	pair->exec_loops = LOOPS;
+	pair->min_samples = 100;
+	fzsync_pair_init(pair);
+
+	run(0, -1);
+	check(*counter == LOOPS);
+	check(!global);
+
+	run(CLONE_VM | CLONE_FILES, -1);
+	check(*counter == LOOPS);
+	check(global == LOOPS);
+
+	early_exit();
+
+	fzsync_pair_info(pair);
+	fzsync_pair_munmap(pair);
+	munmap(counter, sizeof(*counter));
+
+	return check_result();
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the timing profile cache can be saved and loaded
+ * again and that a corrupt profile is ignored.
+ *
+ * No threads are started, the statistics are set directly. After the
+ * round trip the statistics and delay bias must be identical and only
+ * profile_samples are needed to verify them. Further calls to
+ * fzsync_pair_add_bias() must not move the loaded bias.
+ *
+ * Profiles with other keys must survive a save. A line with the right
+ * key but a truncated set of values must not be loaded.
+\*/
+
+#include "check.h"
+
+#define OTHER_LINE "other\tcpu\tkernel\t 1 2 3\n"
+
+static char profile_path[64];
+static struct fzsync_pair pair;
+
+static void set_stats(float v)
+{
+	struct fzsync_stat *stats[] = FZSYNC_PAIR_STATS(&pair);
+	unsigned int i;
+
+	for (i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+		stats[i]->avg = v * (i + 1);
+		stats[i]->avg_dev = v / (i + 1);
+		stats[i]->dev_ratio = 0.01 * (i + 1);
+	}
+}
+
+static int stats_equal(const struct fzsync_pair *a,
+		       const struct fzsync_pair *b)
+{
+	return a->diff_ss.avg == b->diff_ss.avg
+		&& a->diff_sa.avg_dev == b->diff_sa.avg_dev
+		&& a->diff_sb.dev_ratio == b->diff_sb.dev_ratio
+		&& a->diff_ab.avg == b->diff_ab.avg
+		&& a->spins_avg.avg == b->spins_avg.avg
+		&& a->delay_bias == b->delay_bias;
+}
+
+static void write_file(const char *text)
+{
+	FILE *f = fopen(profile_path, "w");
+
+	fputs(text, f);
+	fclose(f);
+}
+
+static void round_trip(void)
+{
+	struct fzsync_pair saved;
+	char line[FZSYNC_PROFILE_LINE];
+	int other = 0;
+	FILE *f;
+
+	write_file(OTHER_LINE);
+
+	check(!fzsync_pair_reset(&pair, NULL));
+	check(!pair.profile_loaded);
+	check(pair.sampling == pair.min_samples);
+
+	set_stats(1234.5678);
+	pair.delay_bias = 7;
+	fzsync_profile_save(&pair);
+	saved = pair;
+
+	set_stats(1);
+	pair.delay_bias = 0;
+	check(!fzsync_pair_reset(&pair, NULL));
+	check(pair.profile_loaded);
+	check(pair.sampling == pair.profile_samples);
+	check(stats_equal(&pair, &saved));
+
+	fzsync_pair_add_bias(&pair, 1);
+	check(pair.delay_bias == 7);
+
+	f = fopen(profile_path, "r");
+	while (f && fgets(line, sizeof(line), f))
+		other += !strcmp(line, OTHER_LINE);
+	if (f)
+		fclose(f);
+	check(other == 1);
+}
+
+static void corrupt(void)
+{
+	char key[FZSYNC_PROFILE_LINE], text[2 * FZSYNC_PROFILE_LINE];
+
+	fzsync_profile_key(&pair, key, sizeof(key));
+	snprintf(text, sizeof(text), "%s\t 1 2 3 4 five\n", key);
+	write_file(text);
+
+	set_stats(1);
+	check(!fzsync_pair_reset(&pair, NULL));
+	check(!pair.profile_loaded);
+	check(pair.sampling == pair.min_samples);
+	check(pair.diff_ss.avg == 0);
+
+	fzsync_pair_add_bias(&pair, 1);
+	check(pair.delay_bias == 8);
+}
+
+int main(void)
+{
+	check_path(profile_path, sizeof(profile_path), "profile.txt");
+	pair.profile_path = profile_path;
+	pair.profile_name = "profile-test";
+	fzsync_pair_init(&pair);
+
+	round_trip();
+	corrupt();
+
+	fzsync_pair_cleanup(&pair);
+	unlink(profile_path);
+
+	return check_result();
+}
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that one pair can alternate between two races which
+ * need opposite delays when each race has its own region.
+ *
+ * The races are from basic. In the first A is long and B is short, in
+ * the second it is the other way around. If the timings were mixed
+ * then the delay range would suit neither race. The test fails if the
+ * window lengths of each region don't reflect its race. Like basic, it
+ * only reports how often the critical sections overlapped because that
+ * requires more than one CPU.
+\*/
+
+#include "fuzzy_sync.h"
+
+/* See basic */
+#define TIME_SCALE(x) ((x) * (x) * (x))
+
+/* See basic */
+struct window {
+	const int critical_s;
+	const int critical_t;
+	const int return_t;
+};
+
+struct race {
+	const struct window a;
+	const struct window b;
+};
+
+static int c;
+static struct fzsync_pair pair;
+
+static const struct race races[] = {
+	{ .a = { 3, 1, 1 }, .b = { 0, 1, 0 } },
+	{ .a = { 0, 1, 0 }, .b = { 1, 1, 3 } },
+};
+
+static const struct fzsync_region *region_state(int region)
+{
+	static struct fzsync_region cur;
+
+	if (region != pair.region)
+		return pair.regions + region;
+
+	cur.diff_sa = pair.diff_sa;
+	cur.diff_sb = pair.diff_sb;
+
+	return &cur;
+}
+
+static void delay(const int t)
+{
+	int k = TIME_SCALE(t);
+
+	while (fzsync_atomic_add_return(-1, &k) > 0)
+		sched_yield();
+}
+
+static void *worker(void *v)
+{
+	const struct window *b;
+	int region;
+
+	while (fzsync_run_b(&pair)) {
+		region = pair.exec_loop % 2;
+		b = &races[region].b;
+
+		fzsync_start_region_b(&pair, region);
+		delay(b->critical_s);
+
+		fzsync_atomic_add_return(1, &c);
+		delay(b->critical_t);
+		fzsync_atomic_add_return(1, &c);
+
+		delay(b->return_t);
+		fzsync_end_region_b(&pair, region);
+	}
+
+	return v;
+}
+
+int main(void)
+{
+	int critical[2] = { 0 }, cs, ct, region, rval;
+	const struct fzsync_region *r0, *r1;
+	const struct window *a;
+
+	pair.min_samples = 10000;
+	pair.exec_time = 30;
+	fzsync_pair_init(&pair);
+
+	rval = fzsync_pair_reset(&pair, worker);
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		return 1;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		region = pair.exec_loop % 2;
+		a = &races[region].a;
+
+		fzsync_start_region_a(&pair, region);
+		delay(a->critical_s);
+
+		cs = fzsync_atomic_add_return(1, &c);
+		delay(a->critical_t);
+		ct = fzsync_atomic_add_return(1, &c);
+
+		delay(a->return_t);
+		fzsync_end_region_a(&pair, region);
+
+		if (!(cs == 1 && ct == 2) && !(cs == 3 && ct == 4))
+			critical[region]++;
+
+		fzsync_atomic_add_return(-4, &c);
+
+		if (critical[0] > 100 && critical[1] > 100)
+			break;
+	}
+
+	fzsync_pair_cleanup(&pair);
+
+	r0 = region_state(0);
+	r1 = region_state(1);
+	fzsync_printf("region 0: a = %.0fns, b = %.0fns, =:%d",
+		      r0->diff_sa.avg, r0->diff_sb.avg, critical[0]);
+	fzsync_printf("region 1: a = %.0fns, b = %.0fns, =:%d",
+		      r1->diff_sa.avg, r1->diff_sb.avg, critical[1]);
+
+	if (r0->diff_sa.avg < 2 * r0->diff_sb.avg
+	    || r1->diff_sb.avg < 2 * r1->diff_sa.avg) {
+		fzsync_printf("FAIL: the regions' timings were mixed");
+		return 1;
+	}
+
+	return 0;
+}
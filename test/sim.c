@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * A discrete event simulation of threads A and B, which evaluates the
+ * delay algorithm without running any threads.
+ *
+ * The real fzsync_pair_update() is called before each simulated race
+ * and the simulated start and end times are written back to the pair
+ * from a virtual clock. So the statistics, sampling period and random
+ * delays are exactly those of a real test, only the timings are made
+ * up.
+ *
+ * Each scenario has a random window length for A and B, a random
+ * critical section within each window, a barrier latency and the
+ * number of nanoseconds per spin. Thread A arrives at the barrier last,
+ * because it calls fzsync_pair_update() first, so it leaves straight
+ * away and thread B leaves when it notices. A race is a hit when the critical
+ * sections overlap. Each scenario runs until its first hit or
+ * SIM_LOOPS races. Half way through, sampling is stopped as if half
+ * of the time limit had been used.
+ *
+ * The families of scenarios add different kinds of noise:
+ * - plain: only a small jitter in the window lengths.
+ * - bimodal: some windows take a slow path which is twice as long.
+ * - preempt: a thread is occasionally stalled for a long time.
+ * - spin: the delay loop is slower than the end of race wait loop.
+ *
+ * For each family the fraction of scenarios which were hit is printed
+ * along with the median and 90th percentile of the races and virtual
+ * time needed. The test fails if too few scenarios of a family were
+ * hit.
+ *
+ * -n sets the number of scenarios per family, -s the random seed and
+ * -v prints the library's messages.
+\*/
+
+#include <stdio.h>
+
+static int verbose, simulating;
+
+/* The library's messages are only printed with -v, the checks' always */
+#define fzsync_printf(fmt, ...) do {					\
+	if (verbose || !simulating)					\
+		printf(fmt "\n", ##__VA_ARGS__);			\
+} while (0)
+
+#include "check.h"
+
+#ifndef ARRAY_SIZE
+# define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
+#define SIM_LOOPS 20000
+#define SIM_MAX_SCENARIOS 10000
+
+/* The kind of noise added to each scenario */
+struct family {
+	const char *name;
+	/* The relative jitter of the window lengths */
+	const float jitter;
+	/* The probability of a window taking the slow path */
+	const float slow_p;
+	/* The probability of a thread being preempted in a race */
+	const float preempt_p;
+	/* The length of a preemption */
+	const float preempt_ns;
+	/* The cost of a delay spin relative to a wait spin */
+	const float delay_spin;
+	/* The minimum fraction of scenarios which must be hit */
+	const float min_hit;
+};
+
+/* The time signature of a code path containing a critical section */
+struct window {
+	/* The length of the whole window */
+	float len;
+	/* The delay until the start of the critical section */
+	float critical_s;
+	/* The length of the critical section */
+	float critical_t;
+};
+
+struct scenario {
+	struct window a;
+	struct window b;
+	/* The time taken by thread B to notice that A arrived at a barrier */
+	float barrier_ns;
+	/* The time taken by one spin of the end of race wait */
+	float wait_spin_ns;
+	/* The time taken by one spin of the delay loop */
+	float delay_spin_ns;
+};
+
+static const struct family families[] = {
+	{ "plain", 0.02, 0, 0, 0, 1, 0.95 },
+	{ "bimodal", 0.02, 0.2, 0, 0, 1, 0.75 },
+	{ "preempt", 0.02, 0, 0.01, 50000, 1, 0.9 },
+	{ "spin", 0.02, 0, 0, 0, 2, 0.9 },
+};
+
+static struct fzsync_pair pair;
+static unsigned short sim_rand[3] = { 0x330E, 0x5EED, 0 };
+static int scenarios = 250;
+static long long races;
+
+static double uniform(double lo, double hi)
+{
+	return lo + (hi - lo) * erand48(sim_rand);
+}
+
+static struct timespec to_ts(long long ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	return ts;
+}
+
+static struct window random_window(void)
+{
+	struct window w;
+
+	w.len = uniform(0, 1);
+	w.len = 200 + 19800 * w.len * w.len * w.len;
+	w.critical_t = MAX(0.02f * w.len, 10.0f);
+	w.critical_s = uniform(0, w.len - w.critical_t);
+
+	return w;
+}
+
+static struct scenario random_scenario(const struct family *f)
+{
+	struct scenario s;
+
+	s.a = random_window();
+	s.b = random_window();
+	s.barrier_ns = uniform(20, 200);
+	s.wait_spin_ns = uniform(1, 5);
+	s.delay_spin_ns = s.wait_spin_ns * f->delay_spin;
+
+	return s;
+}
+
+/*
+ * One execution of a window. The slow path stretches the whole window
+ * and a preemption stalls it at a random point.
+ */
+static struct window run_window(const struct family *f,
+				const struct window *w, int preempt)
+{
+	struct window r = *w;
+	float scale = 1 + f->jitter * uniform(-1, 1);
+	float at;
+
+	if (erand48(sim_rand) < f->slow_p)
+		scale *= 2;
+
+	r.len *= scale;
+	r.critical_s *= scale;
+
+	if (preempt) {
+		at = uniform(0, r.len);
+		if (at < r.critical_s)
+			r.critical_s += f->preempt_ns;
+		r.len += f->preempt_ns;
+	}
+
+	return r;
+}
+
+/*
+ * Simulate one race starting at *now. Thread A leaves the barrier
+ * first, then the delay is spun in one of the threads. The thread which
+ * ends first spins until the other arrives.
+ */
+static int race(const struct family *f, const struct scenario *s,
+		long long *now)
+{
+	double a_start = 0, b_start = s->barrier_ns * uniform(0.5, 1.5);
+	double a_cs, b_cs, a_end, b_end;
+	int preempt = erand48(sim_rand) < f->preempt_p;
+	int preempt_b = erand48(sim_rand) < 0.5;
+	struct window a, b;
+
+	if (pair.delay < 0)
+		a_start -= pair.delay * s->delay_spin_ns;
+	else
+		b_start += pair.delay * s->delay_spin_ns;
+
+	a = run_window(f, &s->a, preempt && !preempt_b);
+	b = run_window(f, &s->b, preempt && preempt_b);
+
+	a_cs = a_start + a.critical_s;
+	b_cs = b_start + b.critical_s;
+	a_end = a_start + a.len;
+	b_end = b_start + b.len;
+
+	pair.a_start = to_ts(*now + (long long)a_start);
+	pair.b_start = to_ts(*now + (long long)b_start);
+	pair.a_end = to_ts(*now + (long long)a_end);
+	pair.b_end = to_ts(*now + (long long)b_end);
+	pair.spins = fabs(a_end - b_end) / s->wait_spin_ns;
+
+	*now += (long long)(MAX(a_end, b_end) + s->barrier_ns);
+	races++;
+
+	return a_cs < b_cs + b.critical_t && b_cs < a_cs + a.critical_t;
+}
+
+/*
+ * Run races until the first hit, with the same bookkeeping as
+ * fzsync_run_a() and fzsync_start_race_a(). Returns the number of races
+ * or zero if there was no hit.
+ */
+static int run_scenario(const struct family *f, long long *now)
+{
+	struct scenario s = random_scenario(f);
+	int loop;
+
+	fzsync_pair_reset(&pair, NULL);
+	*now = 0;
+
+	for (loop = 1; loop <= SIM_LOOPS; loop++) {
+		pair.exec_loop = loop;
+
+		if (loop == SIM_LOOPS / 2 && pair.sampling > 0)
+			pair.sampling = 0;
+
+		fzsync_pair_update(&pair);
+		if (race(f, &s, now))
+			return loop;
+	}
+
+	return 0;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void run_family(const struct family *f)
+{
+	static long long loops[SIM_MAX_SCENARIOS], times[SIM_MAX_SCENARIOS];
+	long long now;
+	int i, loop, hit = 0;
+	float hit_ratio;
+
+	for (i = 0; i < scenarios; i++) {
+		simulating = 1;
+		loop = run_scenario(f, &now);
+		simulating = 0;
+		if (!loop)
+			continue;
+
+		loops[hit] = loop;
+		times[hit] = now;
+		hit++;
+	}
+
+	qsort(loops, hit, sizeof(*loops), cmp_ll);
+	qsort(times, hit, sizeof(*times), cmp_ll);
+	hit_ratio = hit / (float)scenarios;
+
+	printf("%-8s| hit = %.3f, races p50 = %-5lld p90 = %-5lld, time p50 = %.0fus p90 = %.0fus\n",
+	       f->name, hit_ratio,
+	       hit ? loops[hit / 2] : 0, hit ? loops[hit * 9 / 10] : 0,
+	       hit ? times[hit / 2] * 1e-3 : 0,
+	       hit ? times[hit * 9 / 10] * 1e-3 : 0);
+
+	check(hit_ratio >= f->min_hit);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:v")) != -1) {
+		switch (opt) {
+		case 'n':
+			scenarios = atoi(optarg);
+			break;
+		case 's':
+			sim_rand[2] = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			printf("Usage: %s [-n scenarios] [-s seed] [-v]\n",
+			       argv[0]);
+			return 1;
+		}
+	}
+
+	scenarios = MIN(MAX(scenarios, 1), SIM_MAX_SCENARIOS);
+	fzsync_pair_init(&pair);
+	fzsync_time(&start);
+
+	for (i = 0; i < ARRAY_SIZE(families); i++)
+		run_family(families + i);
+
+	fzsync_time(&end);
+	printf("%lld races in %.2fs\n", races,
+	       fzsync_diff_ns(end, start) * 1e-9);
+
+	return check_result();
+}
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the timer mode fires the event inside thread A's
+ * race once sampling has finished, and never while sampling.
+ *
+ * There is no thread B. Thread A's race is a short busy loop and the
+ * timer's event sets a flag. A hit is when the flag changes during
+ * the busy loop. While sampling, the timer fires after the race, so
+ * there must be no hits. Afterwards the offsets cover the race window,
+ * so there must be some hits.
+ *
+ * The same is then checked for two pairs in timer mode at once, each
+ * with its own thread A, as in a pool. Each timer must only fire the
+ * event of its own pair.
+ *
+ * The signal's previous action must be restored on cleanup.
+\*/
+
+#include "check.h"
+
+#define LOOPS 10000
+#define WORK 1000
+#define RUNS 2
+
+struct run {
+	struct fzsync_pair pair;
+	volatile sig_atomic_t fired;
+	int sampling_hits;
+	int random_hits;
+	int random;
+};
+
+static struct run runs[RUNS];
+
+static void event(void *arg)
+{
+	struct run *r = arg;
+
+	r->fired = 1;
+}
+
+static int race_a(struct run *r)
+{
+	volatile int i;
+	int before;
+
+	before = r->fired;
+	for (i = 0; i < WORK; i++)
+		;
+
+	return !before && r->fired;
+}
+
+static void *run_a(void *arg)
+{
+	struct run *r = arg;
+	struct fzsync_pair *pair = &r->pair;
+	int hit, rval;
+
+	memset(r, 0, sizeof(*r));
+	pair->exec_loops = LOOPS;
+	pair->timer_event = event;
+	pair->timer_arg = r;
+	fzsync_pair_init(pair);
+
+	rval = fzsync_pair_reset(pair, NULL);
+	if (rval) {
+		fzsync_printf("fzsync_pair_reset: %s", strerror(rval));
+		failed = 1;
+		return NULL;
+	}
+
+	while (fzsync_tm_run_a(pair)) {
+		r->fired = 0;
+
+		fzsync_tm_start_race_a(pair);
+		hit = race_a(r);
+		fzsync_tm_end_race_a(pair);
+
+		if (pair->tm_sample) {
+			r->sampling_hits += hit;
+		} else {
+			r->random++;
+			r->random_hits += hit;
+		}
+	}
+
+	return NULL;
+}
+
+static void check_run(struct run *r)
+{
+	fzsync_printf("Sampling hits = %d, random hits = %d out of %d",
+		      r->sampling_hits, r->random_hits, r->random);
+	check(!r->sampling_hits);
+	check(r->random > 0);
+	check(r->random_hits > 0);
+	check(!r->pair.tm);
+}
+
+int main(void)
+{
+	pthread_t threads[RUNS];
+	struct sigaction sa;
+	int i, rval;
+
+	run_a(runs);
+	check_run(runs);
+	fzsync_pair_info(&runs[0].pair);
+	check(!sigaction(SIGRTMIN, NULL, &sa) && sa.sa_handler == SIG_DFL);
+
+	fzsync_printf("Running %d timer mode pairs at once", RUNS);
+	for (i = 0; i < RUNS; i++) {
+		rval = pthread_create(threads + i, NULL, run_a, runs + i);
+		if (rval) {
+			fzsync_printf("pthread_create: %s", strerror(rval));
+			return 1;
+		}
+	}
+	for (i = 0; i < RUNS; i++) {
+		pthread_join(threads[i], NULL);
+		check_run(runs + i);
+	}
+	check(!sigaction(SIGRTMIN, NULL, &sa) && sa.sa_handler == SIG_DFL);
+
+	return check_result();
+}
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the uniprocessor mode controls the order of the
+ * threads when they share a CPU.
+ *
+ * The delay bias alternates between delaying thread B and thread A,
+ * while sampling is never allowed to end, so that the delay is just the
+ * bias. Thread A sleeps briefly in its race. When thread A leads,
+ * thread B must run its race inside thread A's sleep. When thread B
+ * leads, it must finish its race before thread A starts.
+ *
+ * This is only deterministic with SCHED_FIFO on a single CPU, otherwise
+ * the order is just printed. Even then a few races may be out of order
+ * on a virtual machine.
+ *
+ * Then thread A breaks out of the loop early. Thread B is asleep
+ * on the futex and must still exit well within FZSYNC_EXIT_NS. Thread A's
+ * scheduling policy must be restored afterwards.
+ *
+ * Finally thread B is started by the test instead of the library. Its
+ * priority can't be set, so the mode must run without SCHED_FIFO.
+\*/
+
+#include "check.h"
+
+#define LOOPS 2000
+#define BIAS 1000
+
+static struct fzsync_pair pair;
+static int pos, a_pos, b_pos, a_sleeping, b_in_gap;
+
+static void *worker(void *v)
+{
+	while (fzsync_up_run_b(&pair)) {
+		fzsync_up_start_race_b(&pair);
+		b_pos = fzsync_atomic_inc(&pos);
+		b_in_gap = fzsync_atomic_load(&a_sleeping);
+		fzsync_up_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static void race_a(void)
+{
+	struct timespec nap = { 0, 20000 };
+
+	a_pos = fzsync_atomic_inc(&pos);
+	fzsync_atomic_store(1, &a_sleeping);
+	nanosleep(&nap, NULL);
+	fzsync_atomic_store(0, &a_sleeping);
+}
+
+static void order(void)
+{
+	int cpus[2], a_led = 0, b_led = 0, wrong = 0, gaps = 0, fifo = 0;
+	int reset;
+
+	reset = fzsync_pair_reset(&pair, worker);
+	check(!reset);
+	if (reset)
+		return;
+
+	while (fzsync_up_run_a(&pair)) {
+		pair.delay_bias = pair.exec_loop & 1 ? BIAS : -BIAS;
+
+		fzsync_up_start_race_a(&pair);
+		race_a();
+		fzsync_up_end_race_a(&pair);
+
+		fifo = pair.up_fifo;
+		if (pair.delay >= 0) {
+			a_led++;
+			gaps += b_in_gap;
+			wrong += a_pos > b_pos || !b_in_gap;
+		} else {
+			b_led++;
+			wrong += b_pos > a_pos || b_in_gap;
+		}
+	}
+
+	fzsync_printf("A led %d times, B %d times, B raced in A's sleep %d times, %d out of order",
+		      a_led, b_led, gaps, wrong);
+	check(a_led + b_led == LOOPS);
+	check(a_led && b_led);
+
+	/* A virtual CPU can still be preempted by the host */
+	if (fifo && fzsync_cpus(cpus, 2) == 1)
+		check(wrong < LOOPS / 100);
+	else
+		fzsync_printf("Not on a single CPU with SCHED_FIFO, the order is not checked");
+}
+
+static void early_exit(void)
+{
+	struct timespec start, end;
+	int reset;
+
+	reset = fzsync_pair_reset(&pair, worker);
+	check(!reset);
+	if (reset)
+		return;
+
+	while (fzsync_up_run_a(&pair)) {
+		fzsync_up_start_race_a(&pair);
+		fzsync_up_end_race_a(&pair);
+
+		if (pair.exec_loop == LOOPS / 2)
+			break;
+	}
+
+	fzsync_time(&start);
+	check(!fzsync_pair_cleanup(&pair));
+	fzsync_time(&end);
+
+	check(fzsync_diff_ns(end, start) < FZSYNC_EXIT_NS / 2);
+	check(!pair.thread_b);
+	check(sched_getscheduler(0) == SCHED_OTHER);
+}
+
+static void external_b(void)
+{
+	pthread_t thread;
+	int loops = 0, fifo = 0;
+
+	check(!fzsync_pair_reset(&pair, NULL));
+	if (pthread_create(&thread, NULL, worker, NULL)) {
+		check(0);
+		return;
+	}
+
+	while (fzsync_up_run_a(&pair)) {
+		fzsync_up_start_race_a(&pair);
+		fzsync_up_end_race_a(&pair);
+
+		fifo |= pair.up_fifo;
+		loops++;
+	}
+
+	fzsync_pair_cleanup(&pair);
+	pthread_join(thread, NULL);
+
+	check(loops == LOOPS);
+	check(!fifo);
+	check(sched_getscheduler(0) == SCHED_OTHER);
+}
+
+int main(void)
+{
+	pair.exec_loops = LOOPS;
+	pair.min_samples = 2 * LOOPS;
+	fzsync_pair_init(&pair);
+
+	order();
+	early_exit();
+	external_b();
+
+	return check_result();
+}
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies that the watchdog reports a hung iteration and can
+ * abort the process.
+ *
+ * Thread B blocks reading an empty pipe in one iteration, as it would
+ * in a deadlocked syscall. The watchdog must report it exactly once.
+ * A helper thread then writes to the pipe so the run can finish.
+ *
+ * With watchdog_abort set, the same run in a child process must be
+ * killed by SIGABRT.
+\*/
+
+#include <sys/resource.h>
+
+#define FZSYNC_WATCHDOG_MIN_NS 200000000LL
+#include "check.h"
+
+#define HANG_LOOP 50
+#define LOOPS 100
+
+static struct fzsync_pair pair;
+static int fds[2];
+
+static void *worker(void *v)
+{
+	char c;
+
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		if (pair.exec_loop == HANG_LOOP && read(fds[0], &c, 1) != 1)
+			fzsync_printf("read: %s", strerror(errno));
+		fzsync_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+/* Stands in for whatever eventually unblocks the hung syscall */
+static void *rescuer(void *v)
+{
+	while (!fzsync_atomic_load(&pair.watchdog_reports))
+		usleep(1000);
+
+	if (write(fds[1], "x", 1) != 1)
+		fzsync_printf("write: %s", strerror(errno));
+
+	return v;
+}
+
+static int run(void)
+{
+	int rval = fzsync_pair_reset(&pair, worker);
+
+	if (rval) {
+		fzsync_printf("pthread_create: %s", strerror(rval));
+		return 1;
+	}
+
+	while (fzsync_run_a(&pair)) {
+		fzsync_start_race_a(&pair);
+		fzsync_end_race_a(&pair);
+	}
+
+	return 0;
+}
+
+static void report(void)
+{
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, rescuer, NULL);
+	check(!run());
+	pthread_join(thread, NULL);
+	fzsync_pair_cleanup(&pair);
+
+	check(pair.watchdog_reports == 1);
+	check(pair.exec_loop == LOOPS + 1);
+}
+
+static void aborts(void)
+{
+	struct rlimit no_core = { 0, 0 };
+	int status;
+	pid_t pid = fork();
+
+	if (!pid) {
+		setrlimit(RLIMIT_CORE, &no_core);
+		pair.watchdog_abort = 1;
+		_exit(run());
+	}
+
+	check(waitpid(pid, &status, 0) == pid);
+	check(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+}
+
+int main(void)
+{
+	if (pipe(fds)) {
+		fzsync_printf("pipe: %s", strerror(errno));
+		return 1;
+	}
+
+	pair.exec_loops = LOOPS;
+	pair.min_samples = 20;
+	pair.watchdog = 1000;
+	fzsync_pair_init(&pair);
+
+	report();
+	aborts();
+
+	return check_result();
+}
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (c) 2026 Fuzzy Sync contributors
+ */
+/*\
+ * [DESCRIPTION]
+ *
+ * This verifies the synthetic workloads in fuzzy_sync_workload.h.
+ *
+ * The distributions are sampled many times and their mean, slow mode
+ * fraction or median is compared with the parameters. A constant
+ * window must take about as long as specified. Races are
+ * loaded from a file and a malformed file must be rejected.
+ *
+ * Finally one of the loaded races is run with fzsync. The critical
+ * sections are far apart without a delay, so they must only overlap
+ * once the random delays start.
+\*/
+
+#include "fuzzy_sync_workload.h"
+#include "check.h"
+
+#define SAMPLES 100000
+
+static char races_path[64];
+static struct fzsync_pair pair;
+static struct fzsync_wl wl;
+static struct fzsync_wl_race races[4];
+static unsigned short rand_a[3] = { 1, 2, 3 }, rand_b[3] = { 4, 5, 6 };
+static int c;
+
+static void write_file(const char *text)
+{
+	FILE *f = fopen(races_path, "w");
+
+	fputs(text, f);
+	fclose(f);
+}
+
+static void parse(void)
+{
+	struct fzsync_wl_dist d;
+
+	check(!fzsync_wl_parse_dist("250", &d));
+	check(d.kind == FZSYNC_WL_CONST && d.ns == 250);
+	check(!fzsync_wl_parse_dist("normal:1000:100", &d));
+	check(d.kind == FZSYNC_WL_NORMAL && d.ns == 1000 && d.dev == 100);
+	check(!fzsync_wl_parse_dist("bimodal:10:20:0.5", &d));
+	check(d.kind == FZSYNC_WL_BIMODAL && d.slow_ns == 20 && d.p == 0.5);
+	check(!fzsync_wl_parse_dist("pareto:100:1.5", &d));
+	check(d.kind == FZSYNC_WL_PARETO && d.alpha == 1.5);
+
+	check(fzsync_wl_parse_dist("normal:1000", &d) == EINVAL);
+	check(fzsync_wl_parse_dist("bimodal:10:20:2", &d) == EINVAL);
+	check(fzsync_wl_parse_dist("pareto:100:0", &d) == EINVAL);
+	check(fzsync_wl_parse_dist("uniform:1:2", &d) == EINVAL);
+	check(fzsync_wl_parse_dist("100ns", &d) == EINVAL);
+}
+
+static void distributions(void)
+{
+	struct fzsync_wl_dist normal = { FZSYNC_WL_NORMAL, .ns = 1000, .dev = 100 };
+	struct fzsync_wl_dist bimodal = {
+		FZSYNC_WL_BIMODAL, .ns = 100, .slow_ns = 1000, .p = 0.2
+	};
+	struct fzsync_wl_dist pareto = { FZSYNC_WL_PARETO, .ns = 100, .alpha = 2 };
+	double sum = 0, sq = 0, x, mean, dev;
+	int i, slow = 0, above = 0;
+
+	for (i = 0; i < SAMPLES; i++) {
+		x = fzsync_wl_sample(&normal, rand_a);
+		sum += x;
+		sq += x * x;
+		slow += fzsync_wl_sample(&bimodal, rand_a) == 1000;
+		/* The median of Pareto(100, 2) is 100 * sqrt(2) */
+		above += fzsync_wl_sample(&pareto, rand_a) > 141.42;
+	}
+
+	mean = sum / SAMPLES;
+	dev = sqrt(sq / SAMPLES - mean * mean);
+	fzsync_printf("normal: mean = %.1f, dev = %.1f; bimodal: slow = %d; pareto: above median = %d",
+		      mean, dev, slow, above);
+
+	check(fabs(mean - 1000) < 5);
+	check(fabs(dev - 100) < 5);
+	check(abs(slow - SAMPLES / 5) < SAMPLES / 100);
+	check(abs(above - SAMPLES / 2) < SAMPLES / 100);
+}
+
+static void spin(void)
+{
+	struct fzsync_wl_dist d = FZSYNC_WL_CONST_NS(100000);
+	struct timespec start, end;
+	long best = LONG_MAX;
+	int i;
+
+	fzsync_wl_init(&wl);
+
+	for (i = 0; i < 5; i++) {
+		fzsync_time(&start);
+		fzsync_wl_spin(&wl, &d, rand_a);
+		fzsync_time(&end);
+		best = MIN(best, fzsync_diff_ns(end, start));
+	}
+
+	fzsync_printf("clock = %.1fns, 100us window took %ldns",
+		      wl.clock_ns, best);
+	check(best >= 99000);
+}
+
+static void load(void)
+{
+	int n;
+
+	write_file("# name a: start length return b: start length return\n"
+		   "\n"
+		   "apart 500 2000 4000 8000 2000 500\n"
+		   "noisy normal:500:50 bimodal:200:400:0.1 0"
+		   " pareto:100:1.5 200 0\n");
+
+	check(!fzsync_wl_load(races_path, races, 4, &n));
+	check(n == 2);
+	check(!strcmp(races[0].name, "apart"));
+	check(races[0].b.critical_s.ns == 8000);
+	check(races[1].a.critical_t.kind == FZSYNC_WL_BIMODAL);
+	check(races[1].b.critical_s.alpha == 1.5f);
+
+	write_file("short 1 2 3 4 5\n");
+	check(fzsync_wl_load(races_path, races + 2, 2, &n) == EINVAL);
+	check(fzsync_wl_load(races_path, races + 2, 0, &n) == E2BIG);
+	unlink(races_path);
+}
+
+static void *worker(void *v)
+{
+	while (fzsync_run_b(&pair)) {
+		fzsync_start_race_b(&pair);
+		fzsync_wl_run(&wl, &races[0].b, rand_b, &c, NULL, NULL);
+		fzsync_end_race_b(&pair);
+	}
+
+	return v;
+}
+
+static void race(void)
+{
+	int cs, ct, before = 0, overlap = 0;
+
+	pair.exec_loops = 20000;
+	fzsync_pair_init(&pair);
+	if (fzsync_pair_reset(&pair, worker))
+		return;
+
+	while (fzsync_run_a(&pair)) {
+		c = 0;
+		fzsync_start_race_a(&pair);
+		fzsync_wl_run(&wl, &races[0].a, rand_a, &c, &cs, &ct);
+		fzsync_end_race_a(&pair);
+
+		if (pair.sampling > 0)
+			before += cs == 1 && ct == 2;
+		else if (!(cs == 1 && ct == 2) && !(cs == 3 && ct == 4))
+			overlap++;
+	}
+
+	fzsync_printf("%s: A first while sampling = %d, overlaps = %d",
+		      races[0].name, before, overlap);
+	check(overlap > 0);
+}
+
+int main(void)
+{
+	check_path(races_path, sizeof(races_path), "workload.txt");
+
+	parse();
+	distributions();
+	spin();
+	load();
+	race();
+
+	return check_result();
+}